@@ -0,0 +1,135 @@
+#ifndef EC_BIT_UTILS_HPP
+#define EC_BIT_UTILS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define EC_BIT_UTILS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace EC {
+
+// Bit helpers of the signature scans of EC::Manager. The scans test 64
+// entities with each AND of bitplane words instead of testing entities one
+// at a time. The bitplane words are atomics that callbacks of a
+// multi-threaded call may change while a scan runs, so they are never read
+// with vector loads; scans of many words of a block first copy them (with
+// atomic loads) into a plain snapshot, and AND the snapshots with
+// andWords(), which uses AVX2 or SSE4.2 when the CPU supports it.
+namespace Internal {
+/// Returns the index of the lowest set bit of the given non-zero value.
+inline unsigned int countTrailingZeros(std::uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned int>(__builtin_ctzll(value));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<unsigned int>(index);
+#else
+    unsigned int index = 0;
+    for (; (value & 1) == 0; value >>= 1) {
+        ++index;
+    }
+    return index;
+#endif
+}
+
+/// Returns the number of set bits of the given value.
+inline unsigned int popCount(std::uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned int>(__builtin_popcountll(value));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return static_cast<unsigned int>(__popcnt64(value));
+#else
+    unsigned int count = 0;
+    for (; value != 0; value &= value - 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+/// Sets out[i] to out[i] & in[i] (or out[i] & ~in[i] if "exclude" is true)
+/// for each i in [0, count), without vector instructions.
+inline void andWordsScalar(std::uint64_t* out, const std::uint64_t* in,
+                           std::size_t count, bool exclude) {
+    const std::uint64_t flip = exclude ? ~std::uint64_t(0) : 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] &= in[i] ^ flip;
+    }
+}
+
+#ifdef EC_BIT_UTILS_X86_DISPATCH
+__attribute__((target("avx2"))) inline void andWordsAvx2(
+    std::uint64_t* out, const std::uint64_t* in, std::size_t count,
+    bool exclude) {
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256i a =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out + i));
+        const __m256i b =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                            exclude ? _mm256_andnot_si256(b, a)
+                                    : _mm256_and_si256(a, b));
+    }
+    andWordsScalar(out + i, in + i, count - i, exclude);
+}
+
+__attribute__((target("sse4.2"))) inline void andWordsSse42(
+    std::uint64_t* out, const std::uint64_t* in, std::size_t count,
+    bool exclude) {
+    std::size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(out + i));
+        const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                         exclude ? _mm_andnot_si128(b, a) : _mm_and_si128(a, b));
+    }
+    andWordsScalar(out + i, in + i, count - i, exclude);
+}
+#endif
+
+using AndWordsFn = void (*)(std::uint64_t*, const std::uint64_t*,
+                            std::size_t, bool);
+
+/// Returns the andWords() variant for the CPU running the program, picked
+/// once on the first call.
+inline AndWordsFn getAndWordsFn() {
+#ifdef EC_BIT_UTILS_X86_DISPATCH
+    static const AndWordsFn fn = []() -> AndWordsFn {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return &andWordsAvx2;
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            return &andWordsSse42;
+        }
+        return &andWordsScalar;
+    }();
+    return fn;
+#else
+    return &andWordsScalar;
+#endif
+}
+
+/// Like andWordsScalar(), but with the vector instructions of the CPU
+/// running the program (see getAndWordsFn()).
+inline void andWords(std::uint64_t* out, const std::uint64_t* in,
+                     std::size_t count, bool exclude) {
+    getAndWordsFn()(out, in, count, exclude);
+}
+}  // namespace Internal
+
+}  // namespace EC
+
+#endif
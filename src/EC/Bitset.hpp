@@ -13,6 +13,7 @@
 #include "Meta/IndexOf.hpp"
 #include "Meta/ForEach.hpp"
 #include "Meta/Contains.hpp"
+#include "Filters.hpp"
 
 namespace EC
 {
@@ -66,9 +67,74 @@ namespace EC
             Bitset<ComponentsList, TagsList> bitset;
 
             EC::Meta::forEach<Contents>([&bitset] (auto t) {
-                if(EC::Meta::Contains<decltype(t), Combined>::value)
+                using Required =
+                    typename EC::Internal::RequiredBy<decltype(t)>::type;
+                if(EC::Meta::Contains<Required, Combined>::value)
                 {
-                    bitset[EC::Meta::IndexOf<decltype(t), Combined>::value] =
+                    bitset[EC::Meta::IndexOf<Required, Combined>::value] =
+                        true;
+                }
+            });
+
+            return bitset;
+        }
+
+        // Sets the bits of the Components and Tags excluded with EC::Without
+        // in the given Contents.
+        template <typename Contents>
+        static constexpr Bitset<ComponentsList, TagsList>
+            generateExcludedBitset()
+        {
+            Bitset<ComponentsList, TagsList> bitset;
+
+            EC::Meta::forEach<Contents>([&bitset] (auto t) {
+                using Excluded =
+                    typename EC::Internal::ExcludedBy<decltype(t)>::type;
+                if(EC::Meta::Contains<Excluded, Combined>::value)
+                {
+                    bitset[EC::Meta::IndexOf<Excluded, Combined>::value] =
+                        true;
+                }
+            });
+
+            return bitset;
+        }
+
+        // Sets the bits of the Components filtered with EC::Changed in the
+        // given Contents.
+        template <typename Contents>
+        static constexpr Bitset<ComponentsList, TagsList>
+            generateChangedBitset()
+        {
+            Bitset<ComponentsList, TagsList> bitset;
+
+            EC::Meta::forEach<Contents>([&bitset] (auto t) {
+                using Changed =
+                    typename EC::Internal::ChangedBy<decltype(t)>::type;
+                if(EC::Meta::Contains<Changed, Combined>::value)
+                {
+                    bitset[EC::Meta::IndexOf<Changed, Combined>::value] =
+                        true;
+                }
+            });
+
+            return bitset;
+        }
+
+        // Sets the bits of the Components filtered with EC::Added in the
+        // given Contents.
+        template <typename Contents>
+        static constexpr Bitset<ComponentsList, TagsList>
+            generateAddedBitset()
+        {
+            Bitset<ComponentsList, TagsList> bitset;
+
+            EC::Meta::forEach<Contents>([&bitset] (auto t) {
+                using Added =
+                    typename EC::Internal::AddedBy<decltype(t)>::type;
+                if(EC::Meta::Contains<Added, Combined>::value)
+                {
+                    bitset[EC::Meta::IndexOf<Added, Combined>::value] =
                         true;
                 }
             });
@@ -0,0 +1,288 @@
+#ifndef EC_FILTERS_HPP
+#define EC_FILTERS_HPP
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+
+#include "Meta/Contains.hpp"
+#include "Meta/TypeList.hpp"
+
+namespace EC {
+
+/*!
+    \brief Signature filter matching only entities that do not have the given
+    Component or Tag.
+
+    A Component given with this filter is not passed to the function called
+    by the "forMatching" functions. A Component or Tag not known to the
+    Manager never excludes an entity.
+
+    Example:
+    \code{.cpp}
+        // entities with C0 but without T0
+        manager.forMatchingSignature<TypeList<C0, EC::Without<T0>>>(
+            [] (std::size_t id, void* context, C0* c0) {});
+    \endcode
+*/
+template <typename ComponentOrTag>
+struct Without {};
+
+/*!
+    \brief Signature filter for a Component that matching entities may or may
+    not have.
+
+    It does not affect which entities match. The function called by the
+    "forMatching" functions receives a pointer to the Component in its place,
+    which is nullptr if the entity does not have it.
+
+    Example:
+    \code{.cpp}
+        manager.forMatchingSignature<TypeList<C0, EC::Optional<C1>>>(
+            [] (std::size_t id, void* context, C0* c0, C1* c1) {
+                if (c1) {
+                    // entity has C1
+                }
+            });
+    \endcode
+*/
+template <typename Component>
+struct Optional {};
+
+/*!
+    \brief Selects whether the changes of a Component are tracked.
+
+    Specialize this as std::true_type for a Component to use it with
+    EC::Changed, EC::Added and EC::Mutable. Changes are not tracked by
+    default, as the Manager keeps two change versions (16 bytes) per entity
+    for each tracked Component, whatever its EC::StoragePolicy.
+
+    Example:
+    \code{.cpp}
+        namespace EC {
+        template <>
+        struct TrackChanges<Transform> : std::true_type {};
+        }
+    \endcode
+*/
+template <typename Component>
+struct TrackChanges : std::false_type {};
+
+/*!
+    \brief Signature filter for a Component that changed after the change
+    filter tick of the Manager.
+
+    Matches only entities that have the Component and whose Component was
+    added with addComponent(), accessed through EC::Mutable or marked with
+    markChanged() after the tick set with EC::Manager::setChangeFilterTick()
+    (0 by default). The function called by the "forMatching" functions
+    receives a pointer to the Component in its place. The changes of the
+    Component must be tracked (see EC::TrackChanges).
+
+    Example:
+    \code{.cpp}
+        manager.setChangeFilterTick(lastTick);
+        lastTick = manager.getChangeTick();
+        manager.forMatchingSignature<TypeList<EC::Changed<Transform>>>(
+            [] (std::size_t id, void* context, Transform* transform) {});
+    \endcode
+*/
+template <typename Component>
+struct Changed {};
+
+/*!
+    \brief Signature filter for a Component that was added after the change
+    filter tick of the Manager.
+
+    Like EC::Changed, but only adding the Component to an entity that did
+    not have it counts as a change.
+*/
+template <typename Component>
+struct Added {};
+
+/*!
+    \brief Signature filter for a Component that the called function may
+    change.
+
+    Matches like the Component itself, and the function receives a pointer
+    to the Component in its place. The Component of every entity the
+    function is called on is marked as changed (see EC::Changed), so the
+    changes of the Component must be tracked (see EC::TrackChanges).
+*/
+template <typename Component>
+struct Mutable {};
+
+namespace Internal {
+/// The Component or Tag an entity must have for a Signature type
+template <typename T>
+struct RequiredBy {
+    using type = T;
+};
+
+template <typename Component>
+struct RequiredBy<Changed<Component> > {
+    using type = Component;
+};
+
+template <typename Component>
+struct RequiredBy<Added<Component> > {
+    using type = Component;
+};
+
+template <typename Component>
+struct RequiredBy<Mutable<Component> > {
+    using type = Component;
+};
+
+/// The Component that must have changed for a Signature type, or void
+template <typename T>
+struct ChangedBy {
+    using type = void;
+};
+
+template <typename Component>
+struct ChangedBy<Changed<Component> > {
+    using type = Component;
+};
+
+/// The Component that must have been added for a Signature type, or void
+template <typename T>
+struct AddedBy {
+    using type = void;
+};
+
+template <typename Component>
+struct AddedBy<Added<Component> > {
+    using type = Component;
+};
+
+/// Whether a Signature type needs the changes of its Component tracked
+template <typename T>
+struct NeedsTracking : std::false_type {};
+
+template <typename Component>
+struct NeedsTracking<Changed<Component> > : std::true_type {};
+
+template <typename Component>
+struct NeedsTracking<Added<Component> > : std::true_type {};
+
+template <typename Component>
+struct NeedsTracking<Mutable<Component> > : std::true_type {};
+
+/// Whether the changes of the Components of the change filters and
+/// EC::Mutable types of a Signature are tracked
+template <typename Signature>
+struct ChangesTracked : std::true_type {};
+
+template <template <typename...> class TTypeList, typename Type,
+          typename... Types>
+struct ChangesTracked<TTypeList<Type, Types...> >
+    : std::integral_constant<
+          bool,
+          (!NeedsTracking<Type>::value ||
+           TrackChanges<typename RequiredBy<Type>::type>::value) &&
+              ChangesTracked<TTypeList<Types...> >::value> {};
+
+/// The number of Components of a list whose changes are tracked
+template <typename ComponentsList>
+struct TrackedCount : std::integral_constant<std::size_t, 0> {};
+
+template <template <typename...> class TTypeList, typename Component,
+          typename... Components>
+struct TrackedCount<TTypeList<Component, Components...> >
+    : std::integral_constant<
+          std::size_t, (TrackChanges<Component>::value ? 1 : 0) +
+                           TrackedCount<TTypeList<Components...> >::value> {
+};
+
+/// The number of Components whose changes are tracked before a Component in
+/// a list
+template <typename Component, typename ComponentsList>
+struct TrackerIndex : std::integral_constant<std::size_t, 0> {};
+
+template <typename Component, template <typename...> class TTypeList,
+          typename Type, typename... Types>
+struct TrackerIndex<Component, TTypeList<Type, Types...> >
+    : std::integral_constant<
+          std::size_t,
+          std::is_same<Component, Type>::value
+              ? 0
+              : (TrackChanges<Type>::value ? 1 : 0) +
+                    TrackerIndex<Component, TTypeList<Types...> >::value> {};
+
+/*!
+    \brief The tracker index (see TrackerIndex) of each Component of a list,
+    or ~0 for the Components whose changes are not tracked, followed by ~0.
+*/
+template <typename ComponentsList>
+struct TrackerIndices;
+
+template <template <typename...> class TTypeList, typename... Components>
+struct TrackerIndices<TTypeList<Components...> > {
+    static std::array<std::size_t, sizeof...(Components) + 1> get() {
+        return {{(TrackChanges<Components>::value
+                      ? TrackerIndex<Components,
+                                     TTypeList<Components...> >::value
+                      : ~std::size_t(0))...,
+                 ~std::size_t(0)}};
+    }
+};
+
+/// Whether a Signature type can be given to the function called by
+/// EC::Manager::forMatchingChunks()
+template <typename T, typename ComponentsList>
+struct IsChunkParameter : EC::Meta::Contains<T, ComponentsList> {};
+
+template <typename Component, typename ComponentsList>
+struct IsChunkParameter<Mutable<Component>, ComponentsList>
+    : EC::Meta::Contains<Component, ComponentsList> {};
+
+/// The Component or Tag excluded by a Signature type, or void if none
+template <typename T>
+struct ExcludedBy {
+    using type = void;
+};
+
+template <typename ComponentOrTag>
+struct ExcludedBy<Without<ComponentOrTag> > {
+    using type = ComponentOrTag;
+};
+
+/// Whether a Signature type is passed to the called function
+template <typename T, typename ComponentsList>
+struct IsSignatureParameter
+    : EC::Meta::Contains<typename RequiredBy<T>::type, ComponentsList> {};
+
+template <typename Component, typename ComponentsList>
+struct IsSignatureParameter<Optional<Component>, ComponentsList>
+    : EC::Meta::Contains<Component, ComponentsList> {};
+
+/*!
+    \brief The types of a Signature that are passed to the called function,
+    in order.
+
+    These are the Components (C for a required Component, or the filter
+    given for it such as EC::Optional<C> or EC::Changed<C>), while Tags and
+    EC::Without filters are dropped.
+*/
+template <typename Signature, typename ComponentsList,
+          typename Parameters = EC::Meta::TypeList<> >
+struct SignatureParameters {
+    using type = Parameters;
+};
+
+template <template <typename...> class TTypeList, typename Type,
+          typename... Types, typename ComponentsList, typename... Parameters>
+struct SignatureParameters<TTypeList<Type, Types...>, ComponentsList,
+                           EC::Meta::TypeList<Parameters...> >
+    : SignatureParameters<
+          TTypeList<Types...>, ComponentsList,
+          typename std::conditional<
+              IsSignatureParameter<Type, ComponentsList>::value,
+              EC::Meta::TypeList<Parameters..., Type>,
+              EC::Meta::TypeList<Parameters...> >::type> {};
+}  // namespace Internal
+
+}  // namespace EC
+
+#endif
@@ -8,18 +8,21 @@
 
 #define EC_INIT_ENTITIES_SIZE 256
 #define EC_GROW_SIZE_AMOUNT 256
+#define EC_CHUNK_SIZE 256
 
 #include <algorithm>
 #include <array>
 #include <atomic>
-#include <chrono>
+#include <condition_variable>
 #include <cstddef>
-#include <deque>
+#include <cstdint>
 #include <functional>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
-#include <thread>
+#include <shared_mutex>
 #include <tuple>
 #include <type_traits>
 #include <unordered_map>
@@ -31,12 +34,15 @@
 #include <iostream>
 #endif
 
+#include "BitUtils.hpp"
 #include "Bitset.hpp"
 #include "Meta/Combine.hpp"
 #include "Meta/ForEachDoubleTuple.hpp"
 #include "Meta/ForEachWithIndex.hpp"
 #include "Meta/IndexOf.hpp"
 #include "Meta/Matching.hpp"
+#include "Meta/TypeListGet.hpp"
+#include "Storage.hpp"
 #include "ThreadPool.hpp"
 
 namespace EC {
@@ -52,43 +58,216 @@ namespace EC {
     the number of threads in the internal ThreadPool, and should be at
     least 2. If ThreadCount is 1 or less, then the ThreadPool will not be
     created and it will never be used, even if the "true" parameter is given
-    for functions that enable its usage.
+    for functions that enable its usage. If ThreadCount is
+    EC::HardwareThreadCount, then std::thread::hardware_concurrency() threads
+    are used. The template parameter only sets the initial thread count, which
+    can be changed at runtime with setThreadCount().
+
+    An optional fourth template parameter selects how components and entity
+    info are stored. EC::DequeStorage (the default) keeps pointers to
+    components valid as the Manager grows. EC::ContiguousStorage stores each
+    Component in a contiguous, cache line aligned array, which is faster to
+    iterate over, but pointers to components are invalidated when the Manager
+    grows beyond its capacity (see reserve()).
+
+    Components that few entities have can be stored in pages allocated only
+    for the entities that own them instead, by specializing EC::StoragePolicy
+    for the Component (see EC::SparseStoragePolicy).
 
     Note that when calling one of the "forMatching" functions that make use
     of the internal ThreadPool, it is allowed to call addEntity() or
     deleteEntity() as the functions cache which entities are alive before
     running (allowing for addEntity()), and the functions defer deletions
-    during concurrent execution (allowing for deleteEntity()).
+    during concurrent execution (allowing for deleteEntity()). The thread that
+    calls a "forMatching" function also executes queued work while it waits,
+    so it counts as an additional worker alongside the ThreadPool's threads.
+
+    Multi-threaded calls reuse buffers kept by the Manager for their sections
+    of entities, alive snapshot and task data, and queue their tasks without
+    allocating (see EC::ThreadPool::queueFn()). Once warmed up, calls that
+    scan the bitplanes therefore do not allocate. Calls that gather the
+    matching entities first (with the archetype index, with
+    setParallelSplitByMatching(), forMatchingSignatures() and stored
+    functions) still build a list of the matching entities on every call.
 
     Example:
     \code{.cpp}
         EC::Manager<TypeList<C0, C1, C2>, TypeList<T0, T1>> manager;
+
+        // contiguous storage with the default thread count
+        EC::Manager<TypeList<C0, C1, C2>, TypeList<T0, T1>, 4,
+                    EC::ContiguousStorage> contiguousManager;
     \endcode
 */
 template <typename ComponentsList, typename TagsList,
-          unsigned int ThreadCount = 4>
+          unsigned int ThreadCount = 4,
+          typename StorageMode = EC::DequeStorage>
 struct Manager {
    public:
     using Components = ComponentsList;
     using Tags = TagsList;
     using Combined = EC::Meta::Combine<ComponentsList, TagsList>;
     using BitsetType = EC::Bitset<ComponentsList, TagsList>;
+    using ThreadPoolType = ThreadPool<ThreadCount>;
 
    private:
     using ComponentsTuple = EC::Meta::Morph<ComponentsList, std::tuple<> >;
     static_assert(std::is_default_constructible<ComponentsTuple>::value,
                   "All components must be default constructible");
 
+    template <typename T>
+    using Column = typename StorageMode::template Column<T>;
+
+    // Components with EC::SparseStoragePolicy are stored in sparse pages
+    template <typename T>
+    using ComponentColumn = typename std::conditional<
+        std::is_same<typename EC::StoragePolicy<T>::type,
+                     EC::SparseStoragePolicy>::value,
+        Internal::SparseColumn<T>, Column<T> >::type;
+
     template <typename... Types>
     struct Storage {
-        using type = std::tuple<std::deque<Types>..., std::deque<char> >;
+        using type = std::tuple<ComponentColumn<Types>..., Column<char> >;
     };
     using ComponentsStorage =
         typename EC::Meta::Morph<ComponentsList, Storage<> >::type;
 
     // Entity: isAlive, ComponentsTags Info
     using EntitiesTupleType = std::tuple<bool, BitsetType>;
-    using EntitiesType = std::deque<EntitiesTupleType>;
+    using EntitiesType = Column<EntitiesTupleType>;
+
+    // Each Component and Tag has a bitplane with one bit per entity, and the
+    // last bitplane holds the alive bits. Signatures are scanned by ANDing
+    // their bitplanes, 64 entities per word. The bitplanes are stored in
+    // fixed size blocks of MatchBlockSize entities so that growing never
+    // moves them, and are updated atomically as entities sharing a word may
+    // be changed by different threads.
+    //
+    // In a block, each bitplane starts with a summary word whose bit i is
+    // set if word i of the bitplane is non-zero, so scans skip words and
+    // whole blocks without alive (or possibly matching) entities.
+    using BitplaneWord = std::atomic<std::uint64_t>;
+    static constexpr std::size_t MatchBlockSize = 4096;
+    static constexpr std::size_t BitplaneCount = Combined::size + 1;
+    static constexpr std::size_t BitplaneWords = MatchBlockSize / 64;
+    static constexpr std::size_t BitplaneStride = BitplaneWords + 1;
+    static_assert(BitplaneWords == 64,
+                  "A summary word must cover the words of a block");
+    std::vector<std::unique_ptr<BitplaneWord[]> > bitplaneBlocks;
+
+    // Each tracked Component (see EC::TrackChanges) of each entity has two
+    // change versions, the tick (see getChangeTick()) of its last change and
+    // of its addition, used by the EC::Changed and EC::Added filters. They
+    // are stored in blocks of MatchBlockSize entities with a tracker per
+    // tracked Component and kind of change (at the index of the Component
+    // among the tracked ones * 2 + ChangeKind). A tracker holds the
+    // highest version in the block, the highest version of each word of 64
+    // entities, then the version of each entity, so that scans skip words
+    // and blocks that did not change.
+    using ChangeVersion = std::atomic<std::uint64_t>;
+    enum ChangeKind : std::size_t { ChangedVersion = 0, AddedVersion = 1 };
+    static constexpr std::size_t ChangeTrackerCount =
+        Internal::TrackedCount<ComponentsList>::value * 2;
+    static constexpr std::size_t ChangeStride =
+        1 + BitplaneWords + MatchBlockSize;
+    std::vector<std::unique_ptr<ChangeVersion[]> > changeBlocks;
+
+    // The addresses of the bitplane and change version blocks. A table is
+    // never changed once published. Growing publishes a new table and keeps
+    // the old ones until reset(), so a scan can keep using the table it
+    // started with while addEntity() grows the Manager from another thread.
+    struct BlockTable {
+        std::vector<BitplaneWord*> bitplanes;
+        std::vector<ChangeVersion*> changes;
+    };
+    std::vector<std::unique_ptr<BlockTable> > blockTables;
+    std::atomic<const BlockTable*> blockTable{nullptr};
+
+    ChangeVersion changeTick{0};
+    std::uint64_t changeFilterTick = 0;
+
+    // the Components and Tags an entity must have and, from EC::Without
+    // filters, must not have to match a signature, and the Components with
+    // EC::Changed and EC::Added filters
+    struct SignatureBitsets {
+        BitsetType required;
+        BitsetType excluded;
+        BitsetType changed;
+        BitsetType added;
+
+        // whether an entity with the given bitset matches, not considering
+        // the EC::Changed and EC::Added filters
+        bool matches(const BitsetType& bitset) const {
+            return (required & bitset) == required &&
+                   (excluded & bitset).none();
+        }
+
+        bool hasChangeFilters() const {
+            return changed.any() || added.any();
+        }
+    };
+
+    template <typename Signature>
+    static SignatureBitsets generateSignatureBitsets() {
+        static_assert(Internal::ChangesTracked<Signature>::value,
+                      "EC::Changed, EC::Added and EC::Mutable need the "
+                      "changes of the Component to be tracked (see "
+                      "EC::TrackChanges)");
+        return {BitsetType::template generateBitset<Signature>(),
+                BitsetType::template generateExcludedBitset<Signature>(),
+                BitsetType::template generateChangedBitset<Signature>(),
+                BitsetType::template generateAddedBitset<Signature>()};
+    }
+
+    // a list of at most Capacity offsets, stored without allocating
+    template <std::size_t Capacity>
+    struct OffsetList {
+        std::array<std::size_t, Capacity> offsets;
+        std::size_t count = 0;
+
+        void push_back(std::size_t offset) { offsets[count++] = offset; }
+        std::size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        std::size_t operator[](std::size_t i) const { return offsets[i]; }
+        const std::size_t* begin() const { return offsets.data(); }
+        const std::size_t* end() const { return offsets.data() + count; }
+    };
+    using BitplaneList = OffsetList<BitplaneCount>;
+
+    // what a "forMatching" function needs to scan entities for a signature
+    struct MatchScan {
+        SignatureBitsets signature;
+        // offsets of the bitplanes of the required and excluded bits within
+        // a block
+        BitplaneList bitplanes;
+        BitplaneList excludedBitplanes;
+        const BlockTable* blocks;
+        // offsets of the change trackers of the EC::Changed and EC::Added
+        // filters within a block, and the tick they must be newer than
+        OffsetList<ChangeTrackerCount> changeTrackers;
+        std::uint64_t changedSince;
+    };
+
+    // how several signatures are matched in a single pass over the entities
+    struct MatchPlan {
+        static constexpr std::size_t NoParent = ~std::size_t(0);
+
+        // a signature is matched starting from the matches of an earlier
+        // step (its parent) whose required and excluded bits are a subset of
+        // its own, so only the remaining bitplanes are tested
+        struct Step {
+            std::size_t signature;
+            std::size_t parent;
+            // the scan of a step without a parent
+            MatchScan scan;
+            // offsets of the bitplanes not tested by the parent
+            BitplaneList bitplanes;
+            BitplaneList excludedBitplanes;
+        };
+        // parents come before their children
+        std::vector<Step> steps;
+        const BlockTable* blocks;
+    };
 
     EntitiesType entities;
     ComponentsStorage componentsStorage;
@@ -96,15 +275,68 @@ struct Manager {
     std::size_t currentSize = 0;
     std::unordered_set<std::size_t> deletedSet;
 
-    std::unique_ptr<ThreadPool<ThreadCount> > threadPool;
+    // a copy of the alive bitplane, one bit per entity ID
+    using AliveBitmapType = std::vector<std::uint64_t>;
+
+    // The ThreadPool of multi-threaded calls, or null. The internal
+    // ThreadPool is only created by the first multi-threaded call (see
+    // usesThreadPool()), with internalThreadCount threads. threadPoolReady is
+    // set once threadPool can be used without locking threadPoolMutex.
+    mutable std::shared_ptr<ThreadPoolType> threadPool;
+    mutable std::atomic_bool threadPoolReady;
+    mutable std::mutex threadPoolMutex;
+    unsigned int internalThreadCount;
 
     std::atomic_uint deferringDeletions;
     std::vector<std::size_t> deferredDeletions;
     std::mutex deferredDeletionsMutex;
 
+    // a section [begin, end) of entities given to a single ThreadPool task
+    using ChunkRange = std::array<std::size_t, 2>;
+
+    // calls the function of one signature of forMatchingSignaturesFused()
+    template <typename FTuple>
+    using FusedCaller = void (*)(Manager&, std::size_t, FTuple&, void*);
+    std::size_t parallelGrainSize = 0;
+    bool parallelSplitByMatching = false;
+
+    // the IDs of the entities with the same Component and Tag bitset, see
+    // setArchetypeIndexEnabled()
+    struct Archetype {
+        explicit Archetype(const BitsetType& bitset)
+            : bitset(bitset), entities{}, sorted(true), mutex{} {}
+
+        const BitsetType bitset;
+        std::vector<std::size_t> entities;
+        // whether entities is in order of ID
+        bool sorted;
+        // guards entities, sorted and the positions of the entities in
+        // entityArchetypes
+        std::mutex mutex;
+    };
+    struct BitsetHash {
+        std::size_t operator()(const BitsetType& bitset) const {
+            return std::hash<std::bitset<Combined::size + 1> >()(bitset);
+        }
+    };
+    bool archetypeIndexEnabled = false;
+    std::vector<std::unique_ptr<Archetype> > archetypes;
+    std::unordered_map<BitsetType, std::size_t, BitsetHash> archetypeIndices;
+    // archetype index and position within it of each alive entity
+    std::vector<std::array<std::size_t, 2> > entityArchetypes;
+    // guards archetypes, archetypeIndices and the size of entityArchetypes.
+    // The callbacks of a multi-threaded "forMatching" call move entities
+    // between existing archetypes with it shared (and the archetypes
+    // locked), while adding or pruning archetypes takes it exclusively.
+    mutable std::shared_timed_mutex archetypeMutex;
+    // the number of archetypes without entities, pruned by the next
+    // getArchetypeMatching()
+    std::atomic_size_t emptyArchetypes{0};
+
     std::vector<std::size_t> idStack;
     std::size_t idStackCounter;
     std::mutex idStackMutex;
+    std::condition_variable idStackCV;
 
    public:
     // section for "temporary" structures {{{
@@ -112,21 +344,19 @@ struct Manager {
     struct TPFnDataStructZero {
         std::array<std::size_t, 2> range;
         Manager* manager;
-        EntitiesType* entities;
-        const BitsetType* signature;
+        const MatchScan* scan;
         void* userData;
-        std::unordered_set<std::size_t> dead;
+        const AliveBitmapType* alive;
     };
     /// Temporary struct used internally by ThreadPool
     template <typename Function>
     struct TPFnDataStructOne {
         std::array<std::size_t, 2> range;
         Manager* manager;
-        EntitiesType* entities;
-        BitsetType* signature;
+        const MatchScan* scan;
         void* userData;
         Function* fn;
-        std::unordered_set<std::size_t> dead;
+        const AliveBitmapType* alive;
     };
     /// Temporary struct used internally by ThreadPool
     struct TPFnDataStructTwo {
@@ -135,26 +365,23 @@ struct Manager {
         EntitiesType* entities;
         void* userData;
         const std::vector<std::size_t>* matching;
-        std::unordered_set<std::size_t> dead;
+        const AliveBitmapType* alive;
     };
     /// Temporary struct used internally by ThreadPool
     struct TPFnDataStructThree {
         std::array<std::size_t, 2> range;
         Manager* manager;
-        std::vector<std::vector<std::size_t> >* matchingV;
-        const std::vector<BitsetType*>* bitsets;
-        EntitiesType* entities;
-        std::mutex* mutex;
-        std::unordered_set<std::size_t> dead;
+        // the matching entities of the range, per signature
+        std::vector<std::vector<std::size_t> > matchingV;
+        const MatchPlan* plan;
+        const AliveBitmapType* alive;
     };
     /// Temporary struct used internally by ThreadPool
     struct TPFnDataStructFour {
         std::array<std::size_t, 2> range;
-        Manager* manager;
-        std::vector<std::vector<std::size_t> >* multiMatchingEntities;
-        BitsetType* signatures;
-        std::mutex* mutex;
-        std::unordered_set<std::size_t> dead;
+        const Manager* manager;
+        const MatchScan* scan;
+        std::size_t count;
     };
     /// Temporary struct used internally by ThreadPool
     struct TPFnDataStructFive {
@@ -163,26 +390,60 @@ struct Manager {
         Manager* manager;
         void* userData;
         std::vector<std::vector<std::size_t> >* multiMatchingEntities;
-        std::unordered_set<std::size_t> dead;
+        const AliveBitmapType* alive;
     };
     /// Temporary struct used internally by ThreadPool
+    template <typename FTuple>
     struct TPFnDataStructSix {
         std::array<std::size_t, 2> range;
         Manager* manager;
-        std::vector<std::vector<std::size_t> >* multiMatchingEntities;
-        BitsetType* bitsets;
-        std::mutex* mutex;
-        std::unordered_set<std::size_t> dead;
+        void* userData;
+        FTuple* fTuple;
+        const FusedCaller<FTuple>* callers;
+        const std::vector<std::vector<std::size_t> >* multiMatchingEntities;
+        const SignatureBitsets* signatureBitsets;
+        const AliveBitmapType* alive;
     };
     /// Temporary struct used internally by ThreadPool
-    template <typename Iterable>
+    template <typename T, typename MapFn, typename CombineFn>
     struct TPFnDataStructSeven {
         std::array<std::size_t, 2> range;
         Manager* manager;
-        EntitiesType* entities;
-        Iterable* iterable;
+        const MatchScan* scan;
+        const std::vector<std::size_t>* matching;
+        MapFn* mapFn;
+        CombineFn* combineFn;
+        const AliveBitmapType* alive;
+        // the value accumulated over the range, null if nothing matched
+        std::unique_ptr<T> partial;
+    };
+    /// Temporary struct used internally by ThreadPool
+    template <typename Function>
+    struct TPFnDataStructEight {
+        std::array<std::size_t, 2> range;
+        const std::vector<std::size_t>* matching;
+        Function* fn;
+    };
+    /// Temporary struct used internally by ThreadPool
+    struct TPFnDataStructNine {
+        std::array<std::size_t, 2> range;
+        const Manager* manager;
+        const MatchScan* scan;
+        // the lowest matching entity found so far, or ~0 if none was found
+        std::atomic_size_t* found;
+        // true if the search stops at any match instead of the lowest one
+        bool any;
+    };
+    /// Temporary struct used internally by ThreadPool
+    template <typename Chunks>
+    struct TPFnDataStructTen {
+        std::array<std::size_t, 2> range;
+        Manager* manager;
+        const MatchScan* scan;
         void* userData;
-        std::unordered_set<std::size_t> dead;
+        const std::vector<std::size_t>* matching;
+        const AliveBitmapType* alive;
+        Chunks* chunks;
     };
     // end section for "temporary" structures }}}
 
@@ -192,21 +453,117 @@ struct Manager {
         The default capacity is set with macro EC_INIT_ENTITIES_SIZE,
         and will grow by amounts of EC_GROW_SIZE_AMOUNT when needed.
     */
-    Manager() : threadPool{}, idStackCounter(0) {
+    Manager()
+        : threadPool{},
+          threadPoolReady(false),
+          internalThreadCount(1),
+          idStackCounter(0) {
         resize(EC_INIT_ENTITIES_SIZE);
-        if (ThreadCount >= 2) {
-            threadPool = std::make_unique<ThreadPool<ThreadCount> >();
-        }
+        setThreadCount(ThreadCount);
 
         deferringDeletions.store(0);
     }
 
-    ~Manager() {
-        if (threadPool) {
-            while (!threadPool->isNotRunning()) {
-                std::this_thread::sleep_for(std::chrono::microseconds(30));
-            }
+    /*!
+        \brief Initializes the manager to use an externally owned ThreadPool.
+
+        Several Managers may share one ThreadPool, which keeps the total
+        number of threads bounded regardless of how many Managers exist. Each
+        multi-threaded call only waits on its own work, so Managers sharing a
+        ThreadPool may be used concurrently from different threads.
+
+        If the given pointer is null, then no ThreadPool is used.
+
+        Example:
+        \code{.cpp}
+            using ManagerType = EC::Manager<TypeList<C0, C1>, TypeList<T0>>;
+            auto pool = std::make_shared<ManagerType::ThreadPoolType>();
+            ManagerType worldA(pool);
+            ManagerType worldB(pool);
+        \endcode
+    */
+    explicit Manager(std::shared_ptr<ThreadPoolType> sharedThreadPool)
+        : threadPool{},
+          threadPoolReady(false),
+          internalThreadCount(1),
+          idStackCounter(0) {
+        resize(EC_INIT_ENTITIES_SIZE);
+        setThreadPool(std::move(sharedThreadPool));
+
+        deferringDeletions.store(0);
+    }
+
+    /*!
+        \brief Replaces the ThreadPool used by this Manager.
+
+        The given ThreadPool may be shared with other Managers. If the given
+        pointer is null, then no ThreadPool is used.
+
+        This must not be called during a call to one of the "forMatching"
+        functions.
+    */
+    void setThreadPool(std::shared_ptr<ThreadPoolType> newThreadPool) {
+        threadPool = std::move(newThreadPool);
+        threadPoolReady.store(threadPool != nullptr);
+        internalThreadCount = 1;
+    }
+
+    /*!
+        \brief Returns the ThreadPool used by this Manager (may be null).
+
+        The internal ThreadPool is only created by the first call that uses
+        it, so this returns null before then.
+    */
+    std::shared_ptr<ThreadPoolType> getThreadPool() const {
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        return threadPool;
+    }
+
+    /*!
+        \brief Changes the number of threads used by the internal ThreadPool.
+
+        If the given count is 1 or less, then the ThreadPool is destroyed and
+        the "forMatching" functions will run on the calling thread even if
+        their "useThreadPool" parameter is true. The given count may be
+        EC::HardwareThreadCount.
+
+        The internal ThreadPool and its threads are only created by the first
+        call with "useThreadPool" set to true, so a Manager that is only used
+        from the calling thread does not start any threads.
+
+        Note that the number of sections entities are split into for
+        multi-threaded calls is derived from the thread count.
+
+        If the ThreadPool is shared with other Managers (see setThreadPool()),
+        then the thread count changes for all of them.
+
+        This must not be called during a call to one of the "forMatching"
+        functions.
+    */
+    void setThreadCount(unsigned int count) {
+        count = Internal::resolveThreadCount(count);
+        if (count < 2) {
+            threadPool.reset();
+            threadPoolReady.store(false);
+            internalThreadCount = 1;
+        } else if (threadPool) {
+            threadPool->setThreadCount(count);
+        } else {
+            internalThreadCount = count;
+        }
+    }
+
+    /*!
+        \brief Returns the number of threads used by the internal ThreadPool,
+        or 1 if the ThreadPool is not used.
+    */
+    unsigned int getThreadCount() const {
+        if (threadPoolReady.load()) {
+            return threadPool->getThreadCount();
         }
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        return threadPool ? threadPool->getThreadCount()
+                          : internalThreadCount;
     }
 
    private:
@@ -216,18 +573,613 @@ struct Manager {
         }
 
         EC::Meta::forEach<ComponentsList>([this, newCapacity](auto t) {
-            std::get<std::deque<decltype(t)> >(this->componentsStorage)
+            std::get<ComponentColumn<decltype(t)> >(this->componentsStorage)
                 .resize(newCapacity);
         });
 
         entities.resize(newCapacity);
+        if (archetypeIndexEnabled) {
+            std::lock_guard<std::shared_timed_mutex> lock(archetypeMutex);
+            entityArchetypes.resize(newCapacity);
+        }
+        while (bitplaneBlocks.size() * MatchBlockSize < newCapacity) {
+            bitplaneBlocks.emplace_back(
+                new BitplaneWord[BitplaneCount * BitplaneStride]);
+            for (std::size_t i = 0; i < BitplaneCount * BitplaneStride; ++i) {
+                bitplaneBlocks.back()[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        while (ChangeTrackerCount != 0 &&
+               changeBlocks.size() * MatchBlockSize < newCapacity) {
+            changeBlocks.emplace_back(
+                new ChangeVersion[ChangeTrackerCount * ChangeStride]);
+            for (std::size_t i = 0; i < ChangeTrackerCount * ChangeStride;
+                 ++i) {
+                changeBlocks.back()[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        const BlockTable* table = blockTable.load(std::memory_order_relaxed);
+        if (!table || table->bitplanes.size() != bitplaneBlocks.size()) {
+            std::unique_ptr<BlockTable> newTable(new BlockTable{});
+            for (const auto& block : bitplaneBlocks) {
+                newTable->bitplanes.push_back(block.get());
+            }
+            for (const auto& block : changeBlocks) {
+                newTable->changes.push_back(block.get());
+            }
+            blockTable.store(newTable.get(), std::memory_order_release);
+            blockTables.push_back(std::move(newTable));
+        }
         for (std::size_t i = currentCapacity; i < newCapacity; ++i) {
             entities[i] = std::make_tuple(false, BitsetType{});
+            setAliveBit(i, false);
         }
 
         currentCapacity = newCapacity;
     }
 
+    void setAliveBit(std::size_t id, bool alive) {
+        setMatchBit(id, Combined::size, alive);
+    }
+
+    // sets a Component/Tag bit (or the alive bit, given Combined::size) in
+    // its bitplane
+    void setMatchBit(std::size_t id, std::size_t index, bool value) {
+        BitplaneWord* plane =
+            blockTable.load(std::memory_order_acquire)
+                ->bitplanes[id / MatchBlockSize] +
+            index * BitplaneStride;
+        const std::size_t word = id % MatchBlockSize / 64;
+        BitplaneWord& bits = plane[1 + word];
+        const std::uint64_t bit = std::uint64_t(1) << (id % 64);
+        const std::uint64_t summaryBit = std::uint64_t(1) << word;
+        if (value) {
+            if (bits.fetch_or(bit) == 0) {
+                plane[0].fetch_or(summaryBit);
+            }
+        } else if ((bits.fetch_and(~bit) & ~bit) == 0) {
+            plane[0].fetch_and(~summaryBit);
+            // another thread may have set a bit of the word meanwhile
+            if (bits.load() != 0) {
+                plane[0].fetch_or(summaryBit);
+            }
+        }
+    }
+
+    MatchScan getMatchScan(const SignatureBitsets& signature) const {
+        MatchScan scan{signature, {}, {},
+                       blockTable.load(std::memory_order_acquire), {},
+                       changeFilterTick};
+        for (std::size_t i = 0; i < Combined::size; ++i) {
+            // a bit may be both required and excluded (as in
+            // TypeList<A, EC::Without<A>>), which then matches nothing
+            if (signature.required[i]) {
+                scan.bitplanes.push_back(i * BitplaneStride);
+            }
+            if (signature.excluded[i]) {
+                scan.excludedBitplanes.push_back(i * BitplaneStride);
+            }
+        }
+        scan.bitplanes.push_back(Combined::size * BitplaneStride);
+        if (signature.hasChangeFilters()) {
+            const auto trackers =
+                Internal::TrackerIndices<ComponentsList>::get();
+            for (std::size_t i = 0; i < Components::size; ++i) {
+                const std::size_t tracker = trackers[i];
+                if (signature.changed[i]) {
+                    scan.changeTrackers.push_back(
+                        (tracker * 2 + ChangedVersion) * ChangeStride);
+                }
+                if (signature.added[i]) {
+                    scan.changeTrackers.push_back(
+                        (tracker * 2 + AddedVersion) * ChangeStride);
+                }
+            }
+        }
+        return scan;
+    }
+
+    // returns the words of the block starting at the given entity that may
+    // have entities matching the scan, from the bitplane summaries
+    std::uint64_t getBlockCandidates(const MatchScan& scan,
+                                     std::size_t blockBegin) const {
+        const BitplaneWord* planes =
+            scan.blocks->bitplanes[blockBegin / MatchBlockSize];
+        std::uint64_t words = ~std::uint64_t(0);
+        for (std::size_t i = 0; i < scan.bitplanes.size() && words != 0; ++i) {
+            words &= planes[scan.bitplanes[i]].load(std::memory_order_relaxed);
+        }
+        for (std::size_t i = 0; i < scan.changeTrackers.size() && words != 0;
+             ++i) {
+            const ChangeVersion* versions =
+                scan.blocks->changes[blockBegin / MatchBlockSize] +
+                scan.changeTrackers[i];
+            if (versions[0].load(std::memory_order_relaxed) <=
+                scan.changedSince) {
+                return 0;
+            }
+            for (std::uint64_t rest = words; rest != 0; rest &= rest - 1) {
+                const unsigned int word = Internal::countTrailingZeros(rest);
+                if (versions[1 + word].load(std::memory_order_relaxed) <=
+                    scan.changedSince) {
+                    words &= ~(std::uint64_t(1) << word);
+                }
+            }
+        }
+        return words;
+    }
+
+    // clears the bits of the entities of [first, first + 64) (given as bits
+    // of a word) that do not pass the EC::Changed and EC::Added filters of
+    // the scan
+    std::uint64_t filterChanged(const MatchScan& scan, std::size_t first,
+                                std::uint64_t bits) const {
+        for (std::size_t i = 0; i < scan.changeTrackers.size() && bits != 0;
+             ++i) {
+            const ChangeVersion* versions =
+                scan.blocks->changes[first / MatchBlockSize] +
+                scan.changeTrackers[i];
+            const std::size_t offset = first % MatchBlockSize;
+            if (versions[1 + offset / 64].load(std::memory_order_relaxed) <=
+                scan.changedSince) {
+                return 0;
+            }
+            const ChangeVersion* entityVersions =
+                versions + 1 + BitplaneWords + offset;
+            for (std::uint64_t rest = bits; rest != 0; rest &= rest - 1) {
+                const unsigned int bit = Internal::countTrailingZeros(rest);
+                if (entityVersions[bit].load(std::memory_order_relaxed) <=
+                    scan.changedSince) {
+                    bits &= ~(std::uint64_t(1) << bit);
+                }
+            }
+        }
+        return bits;
+    }
+
+    // returns the entities of [first, first + 64) matching the scan, as bits
+    // of a word (first must be a multiple of 64)
+    std::uint64_t getWordMatches(const MatchScan& scan,
+                                 std::size_t first) const {
+        const BitplaneWord* words =
+            scan.blocks->bitplanes[first / MatchBlockSize] + 1 +
+            first % MatchBlockSize / 64;
+        std::uint64_t bits = ~std::uint64_t(0);
+        for (std::size_t i = 0; i < scan.bitplanes.size() && bits != 0; ++i) {
+            bits &= words[scan.bitplanes[i]].load(std::memory_order_relaxed);
+        }
+        for (std::size_t i = 0; i < scan.excludedBitplanes.size() && bits != 0;
+             ++i) {
+            bits &= ~words[scan.excludedBitplanes[i]].load(
+                std::memory_order_relaxed);
+        }
+        return filterChanged(scan, first, bits);
+    }
+
+    // blocks with at least this many candidate words are matched with
+    // getBlockMatches() rather than one word at a time
+    static constexpr unsigned int BlockKernelWords = 8;
+
+    // sets matches[i] to the entities of word i of the block at blockBegin
+    // that have the required and none of the excluded bitplanes of the scan
+    // (without the EC::Changed and EC::Added filters), by ANDing plain
+    // snapshots of the bitplanes with Internal::andWords()
+    void getBlockMatches(const MatchScan& scan, std::size_t blockBegin,
+                         std::uint64_t (&matches)[BitplaneWords]) const {
+        const BitplaneWord* planes =
+            scan.blocks->bitplanes[blockBegin / MatchBlockSize] + 1;
+        std::uint64_t snapshot[BitplaneWords];
+        for (std::size_t word = 0; word < BitplaneWords; ++word) {
+            matches[word] = ~std::uint64_t(0);
+        }
+        const std::size_t planeCount =
+            scan.bitplanes.size() + scan.excludedBitplanes.size();
+        for (std::size_t i = 0; i < planeCount; ++i) {
+            const bool exclude = i >= scan.bitplanes.size();
+            const BitplaneWord* words =
+                planes + (exclude
+                              ? scan.excludedBitplanes[i - scan.bitplanes.size()]
+                              : scan.bitplanes[i]);
+            for (std::size_t word = 0; word < BitplaneWords; ++word) {
+                snapshot[word] = words[word].load(std::memory_order_relaxed);
+            }
+            Internal::andWords(matches, snapshot, BitplaneWords, exclude);
+        }
+    }
+
+    // checks a single entity found by a scan again, in case it was changed
+    // since
+    bool stillMatches(const MatchScan& scan, std::size_t id) const {
+        if (!scan.changeTrackers.empty() &&
+            filterChanged(scan, id - id % 64,
+                          std::uint64_t(1) << (id % 64)) == 0) {
+            return false;
+        }
+        const BitplaneWord* words =
+            scan.blocks->bitplanes[id / MatchBlockSize] + 1 +
+            id % MatchBlockSize / 64;
+        const unsigned int bit = id % 64;
+        for (std::size_t index : scan.bitplanes) {
+            if (((words[index].load(std::memory_order_relaxed) >> bit) & 1) ==
+                0) {
+                return false;
+            }
+        }
+        for (std::size_t index : scan.excludedBitplanes) {
+            if ((words[index].load(std::memory_order_relaxed) >> bit) & 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // calls fn(id) on each alive entity in [begin, end) matching the
+    // signature of the given scan
+    template <typename Function>
+    void scanMatching(const MatchScan& scan, std::size_t begin,
+                      std::size_t end, Function&& fn) const {
+        if (scan.signature.required[Combined::size]) {
+            // the last bit (set by an unknown Component or Tag) never matches
+            return;
+        }
+
+        for (std::size_t blockBegin = begin - begin % MatchBlockSize;
+             blockBegin < end; blockBegin += MatchBlockSize) {
+            std::uint64_t words = getBlockCandidates(scan, blockBegin);
+            if (blockBegin < begin) {
+                words &= ~std::uint64_t(0) << (begin - blockBegin) / 64;
+            }
+            const std::size_t wordCount = (end - blockBegin + 63) / 64;
+            if (wordCount < BitplaneWords) {
+                words &= (std::uint64_t(1) << wordCount) - 1;
+            }
+
+            std::uint64_t matches[BitplaneWords];
+            const bool useKernel =
+                Internal::popCount(words) >= BlockKernelWords;
+            if (useKernel) {
+                getBlockMatches(scan, blockBegin, matches);
+            }
+            for (; words != 0; words &= words - 1) {
+                const unsigned int word = Internal::countTrailingZeros(words);
+                const std::size_t first = blockBegin + word * 64;
+                const std::size_t wordBegin = first < begin ? begin : first;
+                const std::size_t wordEnd = end - first < 64 ? end : first + 64;
+                scanBitplaneWord(
+                    scan, first, wordBegin, wordEnd,
+                    useKernel ? filterChanged(scan, first, matches[word])
+                              : getWordMatches(scan, first),
+                    fn);
+            }
+        }
+    }
+
+    // scans [begin, end) within the entities [first, first + 64), of which
+    // "bits" are the matches
+    template <typename Function>
+    void scanBitplaneWord(const MatchScan& scan, std::size_t first,
+                          std::size_t begin, std::size_t end,
+                          std::uint64_t bits, Function& fn) const {
+        if (first < begin) {
+            bits &= ~std::uint64_t(0) << (begin - first);
+        }
+        if (end - first < 64) {
+            bits &= (std::uint64_t(1) << (end - first)) - 1;
+        }
+        for (; bits != 0; bits &= bits - 1) {
+            const std::size_t id = first + Internal::countTrailingZeros(bits);
+            // checked again in case fn changed the entity
+            if (stillMatches(scan, id)) {
+                fn(id);
+            }
+        }
+    }
+
+    // returns the first entity in [from, end) matching the scan, or end if
+    // there is none, and sets "rest" to the other matches in the same word
+    // (as bits of the word)
+    std::size_t findMatching(const MatchScan& scan, std::size_t from,
+                             std::size_t end, std::uint64_t& rest) const {
+        rest = 0;
+        if (scan.signature.required[Combined::size]) {
+            return end;
+        }
+
+        while (from < end) {
+            const std::size_t blockBegin = from - from % MatchBlockSize;
+            std::uint64_t words =
+                getBlockCandidates(scan, blockBegin) &
+                (~std::uint64_t(0) << (from - blockBegin) / 64);
+            for (; words != 0; words &= words - 1) {
+                const std::size_t first =
+                    blockBegin + Internal::countTrailingZeros(words) * 64;
+                if (first >= end) {
+                    return end;
+                }
+                std::uint64_t bits = getWordMatches(scan, first);
+                if (first < from) {
+                    bits &= ~std::uint64_t(0) << (from - first);
+                }
+                if (bits != 0) {
+                    const std::size_t id =
+                        first + Internal::countTrailingZeros(bits);
+                    rest = bits & (bits - 1);
+                    return id < end ? id : end;
+                }
+            }
+            from = blockBegin + MatchBlockSize;
+        }
+        return end;
+    }
+
+    // like findMatching() over all entities, but searches sections of
+    // entities in parallel; sections stop once a match before them was found
+    // (or any match if "any" is true)
+    std::size_t findMatchingParallel(const MatchScan& scan, bool any) const {
+        std::atomic_size_t found(~std::size_t(0));
+        ScratchLease scratch(*this);
+        const std::vector<ChunkRange>& ranges =
+            scratch.getChunkRanges(currentSize);
+        TPFnDataStructNine* fnDataAr =
+            scratch.template getTaskData<TPFnDataStructNine>(ranges.size());
+        TPBatch batch;
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            fnDataAr[i].range = ranges[i];
+            fnDataAr[i].manager = this;
+            fnDataAr[i].scan = &scan;
+            fnDataAr[i].found = &found;
+            fnDataAr[i].any = any;
+            threadPool->queueFn(
+                [](void* ud) {
+                    auto* data = static_cast<TPFnDataStructNine*>(ud);
+                    data->manager->findMatchingSection(*data);
+                },
+                &fnDataAr[i], batch);
+        }
+        threadPool->easyStartAndWait(batch);
+
+        const std::size_t id = found.load();
+        return id < currentSize ? id : currentSize;
+    }
+
+    void findMatchingSection(TPFnDataStructNine& data) const {
+        std::size_t from = data.range[0];
+        while (from < data.range[1]) {
+            const std::size_t found = data.found->load();
+            if (data.any ? found != ~std::size_t(0) : found < from) {
+                return;
+            }
+            // searched a block at a time to check for matches found by other
+            // sections in between
+            const std::size_t end = std::min(
+                data.range[1], from - from % MatchBlockSize + MatchBlockSize);
+            std::uint64_t rest;
+            const std::size_t id = findMatching(*data.scan, from, end, rest);
+            if (id < end) {
+                std::size_t lowest = data.found->load();
+                while (id < lowest &&
+                       !data.found->compare_exchange_weak(lowest, id)) {
+                }
+                return;
+            }
+            from = end;
+        }
+    }
+
+    MatchPlan getMatchPlan(
+        const std::vector<const SignatureBitsets*>& signatures) const {
+        MatchPlan plan;
+        plan.blocks = blockTable.load(std::memory_order_acquire);
+
+        // a signature can only include the bits of one with fewer bits, and
+        // more bits usually means fewer matches
+        std::vector<std::size_t> order;
+        for (std::size_t i = 0; i < signatures.size(); ++i) {
+            // the last bit (set by an unknown Component or Tag) never matches
+            if (!signatures[i]->required[Combined::size]) {
+                order.push_back(i);
+            }
+        }
+        const auto bitCount = [&signatures](std::size_t i) {
+            return signatures[i]->required.count() +
+                   signatures[i]->excluded.count();
+        };
+        std::stable_sort(order.begin(), order.end(),
+                         [&bitCount](std::size_t a, std::size_t b) {
+                             return bitCount(a) < bitCount(b);
+                         });
+
+        for (std::size_t i : order) {
+            const SignatureBitsets& signature = *signatures[i];
+            // the parent is the earlier step including the most bits, and
+            // the matches of a signature with EC::Changed or EC::Added
+            // filters are only reused as a whole
+            std::size_t parent = MatchPlan::NoParent;
+            for (std::size_t s = 0;
+                 s < plan.steps.size() && !signature.hasChangeFilters(); ++s) {
+                const SignatureBitsets& other =
+                    *signatures[plan.steps[s].signature];
+                if (!other.hasChangeFilters() &&
+                    (other.required & signature.required) == other.required &&
+                    (other.excluded & signature.excluded) == other.excluded &&
+                    (parent == MatchPlan::NoParent ||
+                     bitCount(plan.steps[s].signature) >
+                         bitCount(plan.steps[parent].signature))) {
+                    parent = s;
+                }
+            }
+
+            typename MatchPlan::Step step{i, parent, MatchScan{}, {}, {}};
+            if (parent == MatchPlan::NoParent) {
+                step.scan = getMatchScan(signature);
+            } else {
+                const SignatureBitsets& other =
+                    *signatures[plan.steps[parent].signature];
+                for (std::size_t b = 0; b < Combined::size; ++b) {
+                    if (signature.required[b] && !other.required[b]) {
+                        step.bitplanes.push_back(b * BitplaneStride);
+                    }
+                    if (signature.excluded[b] && !other.excluded[b]) {
+                        step.excludedBitplanes.push_back(b * BitplaneStride);
+                    }
+                }
+            }
+            plan.steps.push_back(std::move(step));
+        }
+        return plan;
+    }
+
+    // adds the alive entities in [begin, end) matching each signature of the
+    // plan to "matchingV" (indexed by signature), in order of ID, and skips
+    // entities not alive in "alive" if it is not null
+    void scanPlanned(const MatchPlan& plan, std::size_t begin, std::size_t end,
+                     const AliveBitmapType* alive,
+                     std::vector<std::vector<std::size_t> >& matchingV) const {
+        const std::size_t count = plan.steps.size();
+        std::vector<std::uint64_t> candidates(count);
+        std::vector<std::uint64_t> matches(count);
+
+        for (std::size_t blockBegin = begin - begin % MatchBlockSize;
+             blockBegin < end; blockBegin += MatchBlockSize) {
+            const BitplaneWord* planes =
+                plan.blocks->bitplanes[blockBegin / MatchBlockSize];
+            std::uint64_t range = ~std::uint64_t(0);
+            if (blockBegin < begin) {
+                range &= ~std::uint64_t(0) << (begin - blockBegin) / 64;
+            }
+            const std::size_t wordCount = (end - blockBegin + 63) / 64;
+            if (wordCount < BitplaneWords) {
+                range &= (std::uint64_t(1) << wordCount) - 1;
+            }
+
+            // a step's candidate words are a subset of its parent's
+            std::uint64_t words = 0;
+            for (std::size_t s = 0; s < count; ++s) {
+                const typename MatchPlan::Step& step = plan.steps[s];
+                std::uint64_t stepWords =
+                    step.parent == MatchPlan::NoParent
+                        ? getBlockCandidates(step.scan, blockBegin) & range
+                        : candidates[step.parent];
+                for (std::size_t i = 0;
+                     i < step.bitplanes.size() && stepWords != 0; ++i) {
+                    stepWords &= planes[step.bitplanes[i]].load(
+                        std::memory_order_relaxed);
+                }
+                candidates[s] = stepWords;
+                words |= stepWords;
+            }
+
+            for (; words != 0; words &= words - 1) {
+                const unsigned int word = Internal::countTrailingZeros(words);
+                const std::size_t first = blockBegin + word * 64;
+                std::uint64_t wordRange = ~std::uint64_t(0);
+                if (first < begin) {
+                    wordRange &= ~std::uint64_t(0) << (begin - first);
+                }
+                if (end - first < 64) {
+                    wordRange &= (std::uint64_t(1) << (end - first)) - 1;
+                }
+                const BitplaneWord* planeWords = planes + 1 + word;
+
+                for (std::size_t s = 0; s < count; ++s) {
+                    const typename MatchPlan::Step& step = plan.steps[s];
+                    std::uint64_t bits = 0;
+                    if ((candidates[s] >> word) & 1) {
+                        bits = step.parent == MatchPlan::NoParent
+                                   ? getWordMatches(step.scan, first) &
+                                         wordRange
+                                   : matches[step.parent];
+                        for (std::size_t i = 0;
+                             i < step.bitplanes.size() && bits != 0; ++i) {
+                            bits &= planeWords[step.bitplanes[i]].load(
+                                std::memory_order_relaxed);
+                        }
+                        for (std::size_t i = 0;
+                             i < step.excludedBitplanes.size() && bits != 0;
+                             ++i) {
+                            bits &= ~planeWords[step.excludedBitplanes[i]].load(
+                                std::memory_order_relaxed);
+                        }
+                    }
+                    matches[s] = bits;
+
+                    std::vector<std::size_t>& matching =
+                        matchingV[step.signature];
+                    for (; bits != 0; bits &= bits - 1) {
+                        const std::size_t id =
+                            first + Internal::countTrailingZeros(bits);
+                        if (!alive || isAliveIn(*alive, id)) {
+                            matching.push_back(id);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // returns the number of alive entities in [begin, end) matching the scan
+    std::size_t countMatches(const MatchScan& scan, std::size_t begin,
+                             std::size_t end) const {
+        if (scan.signature.required[Combined::size]) {
+            return 0;
+        }
+
+        std::size_t count = 0;
+        for (std::size_t blockBegin = begin - begin % MatchBlockSize;
+             blockBegin < end; blockBegin += MatchBlockSize) {
+            std::uint64_t words = getBlockCandidates(scan, blockBegin);
+            if (blockBegin < begin) {
+                words &= ~std::uint64_t(0) << (begin - blockBegin) / 64;
+            }
+            const std::size_t wordCount = (end - blockBegin + 63) / 64;
+            if (wordCount < BitplaneWords) {
+                words &= (std::uint64_t(1) << wordCount) - 1;
+            }
+
+            std::uint64_t matches[BitplaneWords];
+            const bool useKernel =
+                Internal::popCount(words) >= BlockKernelWords;
+            if (useKernel) {
+                getBlockMatches(scan, blockBegin, matches);
+            }
+            for (; words != 0; words &= words - 1) {
+                const unsigned int word = Internal::countTrailingZeros(words);
+                const std::size_t first = blockBegin + word * 64;
+                std::uint64_t bits =
+                    useKernel ? filterChanged(scan, first, matches[word])
+                              : getWordMatches(scan, first);
+                if (first < begin) {
+                    bits &= ~std::uint64_t(0) << (begin - first);
+                }
+                if (end - first < 64) {
+                    bits &= (std::uint64_t(1) << (end - first)) - 1;
+                }
+                count += Internal::popCount(bits);
+            }
+        }
+        return count;
+    }
+
+    static bool isAliveIn(const AliveBitmapType& bitmap, std::size_t id) {
+        return (bitmap[id / 64] >> (id % 64)) & 1;
+    }
+
+    // copies the words of the alive bitplane that cover [0, currentSize),
+    // used by multi-threaded calls so that entities added during the call
+    // are skipped
+    void getAliveSnapshot(AliveBitmapType& snapshot) const {
+        const BlockTable* blocks = blockTable.load(std::memory_order_acquire);
+        const std::size_t wordCount = (currentSize + 63) / 64;
+        snapshot.resize(wordCount);
+        for (std::size_t i = 0; i < wordCount; ++i) {
+            const BitplaneWord* alivePlane =
+                blocks->bitplanes[i / BitplaneWords] +
+                Combined::size * BitplaneStride;
+            snapshot[i] = alivePlane[1 + i % BitplaneWords].load(
+                std::memory_order_relaxed);
+        }
+    }
+
    public:
     /*!
         \brief Adds an entity to the system, returning the ID of the entity.
@@ -241,6 +1193,11 @@ struct Manager {
             }
 
             std::get<bool>(entities[currentSize]) = true;
+            setAliveBit(currentSize, true);
+            if (archetypeIndexEnabled) {
+                archetypeInsert(currentSize);
+            }
+            updateMatchingCaches(currentSize, BitsetType{}, false);
 
             return currentSize++;
         } else {
@@ -251,6 +1208,11 @@ struct Manager {
                 deletedSet.erase(iter);
             }
             std::get<bool>(entities[id]) = true;
+            setAliveBit(id, true);
+            if (archetypeIndexEnabled) {
+                archetypeInsert(id);
+            }
+            updateMatchingCaches(id, BitsetType{}, false);
             return id;
         }
     }
@@ -258,32 +1220,747 @@ struct Manager {
    private:
     void deleteEntityImpl(std::size_t id) {
         if (hasEntity(id)) {
+            const bool wasAlive = std::get<bool>(entities[id]);
+            const BitsetType before = std::get<BitsetType>(entities[id]);
+            if (archetypeIndexEnabled && wasAlive) {
+                archetypeErase(id);
+            }
             std::get<bool>(entities.at(id)) = false;
+            setAliveBit(id, false);
             std::get<BitsetType>(entities.at(id)).reset();
+            for (std::size_t i = 0; i < Combined::size; ++i) {
+                if (before[i]) {
+                    setMatchBit(id, i, false);
+                }
+            }
             deletedSet.insert(id);
+            updateMatchingCaches(id, before, wasAlive);
+            EC::Meta::forEach<ComponentsList>([this, id](auto t) {
+                eraseColumnElement(
+                    std::get<ComponentColumn<decltype(t)> >(
+                        this->componentsStorage),
+                    id);
+            });
         }
     }
 
-   public:
-    /*!
-        \brief Marks an entity for deletion.
+    // sets a Component or Tag bit of an alive entity
+    void setEntityBit(std::size_t id, std::size_t index, bool value) {
+        BitsetType& bitset = std::get<BitsetType>(entities[id]);
+        if (bitset[index] == value) {
+            return;
+        }
+        if (archetypeIndexEnabled) {
+            archetypeErase(id);
+        }
+        const BitsetType before = bitset;
+        bitset[index] = value;
+        setMatchBit(id, index, value);
+        if (archetypeIndexEnabled) {
+            archetypeInsert(id);
+        }
+        updateMatchingCaches(id, before, true);
+    }
 
-        A deleted Entity's id is stored to be reclaimed later when
-        addEntity is called. Thus calling addEntity may return an id of
-        a previously deleted Entity.
-    */
-    void deleteEntity(std::size_t index) {
-        if (deferringDeletions.load() != 0) {
-            std::lock_guard<std::mutex> lock(deferredDeletionsMutex);
-            deferredDeletions.push_back(index);
-        } else {
-            deleteEntityImpl(index);
+    // updates the cached matching entities of stored functions after an
+    // entity changed, given its bitset and whether it was alive before
+    void updateMatchingCaches(std::size_t id, const BitsetType& before,
+                              bool wasAlive) {
+        const bool alive = std::get<bool>(entities[id]);
+        const BitsetType& after = std::get<BitsetType>(entities[id]);
+        for (auto& pair : forMatchingFunctions) {
+            const SignatureBitsets& signature =
+                std::get<SignatureBitsets>(pair.second);
+            const bool matched = wasAlive && signature.matches(before);
+            const bool matches = alive && signature.matches(after);
+            if (matched != matches) {
+                // the callbacks of a multi-threaded "forMatching" call may
+                // change different entities at the same time
+                std::lock_guard<std::mutex> lock(matchingCachesMutex);
+                MatchingCache& cache = std::get<MatchingCache>(pair.second);
+                if (matches) {
+                    cache.insert(id, currentCapacity);
+                } else {
+                    cache.erase(id);
+                }
+            }
         }
     }
 
-   private:
-    void handleDeferredDeletions() {
-        if (deferringDeletions.fetch_sub(1) == 1) {
+    // adds an alive entity to the archetype of its bitset
+    void archetypeInsert(std::size_t id) {
+        const BitsetType& bitset = std::get<BitsetType>(entities[id]);
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(archetypeMutex);
+            auto iter = archetypeIndices.find(bitset);
+            if (iter != archetypeIndices.end()) {
+                std::lock_guard<std::mutex> archetypeLock(
+                    archetypes[iter->second]->mutex);
+                addToArchetype(id, iter->second);
+                return;
+            }
+        }
+        std::lock_guard<std::shared_timed_mutex> lock(archetypeMutex);
+        auto iter = archetypeIndices.find(bitset);
+        if (iter == archetypeIndices.end()) {
+            iter = archetypeIndices.emplace(bitset, archetypes.size()).first;
+            archetypes.push_back(std::make_unique<Archetype>(bitset));
+            // counted as empty until the entity is added below
+            emptyArchetypes.fetch_add(1);
+        }
+        addToArchetype(id, iter->second);
+    }
+
+    // adds an entity to the given archetype, which must be locked
+    void addToArchetype(std::size_t id, std::size_t index) {
+        Archetype& archetype = *archetypes[index];
+        if (archetype.entities.empty()) {
+            emptyArchetypes.fetch_sub(1);
+        } else if (archetype.entities.back() > id) {
+            archetype.sorted = false;
+        }
+        entityArchetypes[id] = {index, archetype.entities.size()};
+        archetype.entities.push_back(id);
+    }
+
+    // removes an entity from its archetype
+    void archetypeErase(std::size_t id) {
+        std::shared_lock<std::shared_timed_mutex> lock(archetypeMutex);
+        Archetype& archetype = *archetypes[entityArchetypes[id][0]];
+        std::lock_guard<std::mutex> archetypeLock(archetype.mutex);
+        std::vector<std::size_t>& list = archetype.entities;
+        const std::size_t position = entityArchetypes[id][1];
+        if (position != list.size() - 1) {
+            list[position] = list.back();
+            entityArchetypes[list[position]][1] = position;
+            archetype.sorted = false;
+        }
+        list.pop_back();
+        if (list.empty()) {
+            emptyArchetypes.fetch_add(1);
+        }
+    }
+
+    void clearArchetypes() {
+        std::lock_guard<std::shared_timed_mutex> lock(archetypeMutex);
+        archetypes.clear();
+        archetypeIndices.clear();
+        emptyArchetypes.store(0);
+    }
+
+    // removes the archetypes without entities, with archetypeMutex locked
+    // exclusively
+    void pruneArchetypes() {
+        for (std::size_t i = 0; i < archetypes.size();) {
+            if (!archetypes[i]->entities.empty()) {
+                ++i;
+                continue;
+            }
+            archetypeIndices.erase(archetypes[i]->bitset);
+            if (i != archetypes.size() - 1) {
+                archetypes[i] = std::move(archetypes.back());
+                archetypeIndices[archetypes[i]->bitset] = i;
+                for (std::size_t id : archetypes[i]->entities) {
+                    entityArchetypes[id][0] = i;
+                }
+            }
+            archetypes.pop_back();
+        }
+        emptyArchetypes.store(0);
+    }
+
+    // returns the alive entities matching the given bitset in order of ID,
+    // using the archetype index
+    std::vector<std::size_t> getArchetypeMatching(
+        const SignatureBitsets& signature) {
+        if (emptyArchetypes.load() != 0) {
+            std::lock_guard<std::shared_timed_mutex> lock(archetypeMutex);
+            pruneArchetypes();
+        }
+        std::shared_lock<std::shared_timed_mutex> lock(archetypeMutex);
+        // the matching archetypes stay locked until they are merged, and
+        // they are locked in order of index, while changes to entities only
+        // lock one archetype at a time
+        std::vector<std::unique_lock<std::mutex> > archetypeLocks;
+        // the remaining entities of each matching archetype
+        using Range = std::pair<const std::size_t*, const std::size_t*>;
+        std::vector<Range> ranges;
+        std::size_t count = 0;
+        for (const auto& archetypePtr : archetypes) {
+            Archetype& archetype = *archetypePtr;
+            if (!signature.matches(archetype.bitset)) {
+                continue;
+            }
+            archetypeLocks.emplace_back(archetype.mutex);
+            if (archetype.entities.empty()) {
+                continue;
+            }
+            // an archetype is only sorted again after it was changed, and
+            // the sorted archetypes are merged instead of sorting the result
+            if (!archetype.sorted) {
+                std::sort(archetype.entities.begin(), archetype.entities.end());
+                for (std::size_t i = 0; i < archetype.entities.size(); ++i) {
+                    entityArchetypes[archetype.entities[i]][1] = i;
+                }
+                archetype.sorted = true;
+            }
+            ranges.emplace_back(
+                archetype.entities.data(),
+                archetype.entities.data() + archetype.entities.size());
+            count += archetype.entities.size();
+        }
+
+        std::vector<std::size_t> matching;
+        matching.reserve(count);
+        if (ranges.empty()) {
+            return matching;
+        } else if (ranges.size() == 1) {
+            matching.assign(ranges[0].first, ranges[0].second);
+            return matching;
+        }
+        // merges all archetypes at once, with a heap of the ranges ordered
+        // by their next entity
+        const auto laterRange = [](const Range& a, const Range& b) {
+            return *a.first > *b.first;
+        };
+        std::make_heap(ranges.begin(), ranges.end(), laterRange);
+        while (!ranges.empty()) {
+            std::pop_heap(ranges.begin(), ranges.end(), laterRange);
+            Range& range = ranges.back();
+            matching.push_back(*range.first);
+            if (++range.first == range.second) {
+                ranges.pop_back();
+            } else {
+                std::push_heap(ranges.begin(), ranges.end(), laterRange);
+            }
+        }
+        return matching;
+    }
+
+    // removes the entities that do not pass the EC::Changed and EC::Added
+    // filters of the given signature
+    void removeUnchanged(const SignatureBitsets& signature,
+                         std::vector<std::size_t>& ids) const {
+        if (!signature.hasChangeFilters()) {
+            return;
+        }
+        const MatchScan scan = getMatchScan(signature);
+        ids.erase(std::remove_if(ids.begin(), ids.end(),
+                                 [this, &scan](std::size_t id) {
+                                     return filterChanged(
+                                                scan, id - id % 64,
+                                                std::uint64_t(1)
+                                                    << (id % 64)) == 0;
+                                 }),
+                  ids.end());
+    }
+
+    // sets a change version of a Component of an entity, if the changes of
+    // the Component are tracked
+    template <typename Component>
+    void setChangeVersion(std::size_t id, ChangeKind kind,
+                          std::uint64_t version) {
+        setChangeVersion(
+            id, Internal::TrackerIndex<Component, ComponentsList>::value,
+            kind, version, EC::TrackChanges<Component>{});
+    }
+
+    void setChangeVersion(std::size_t, std::size_t, ChangeKind,
+                          std::uint64_t, std::false_type) {}
+
+    void setChangeVersion(std::size_t id, std::size_t tracker,
+                          ChangeKind kind, std::uint64_t version,
+                          std::true_type) {
+        ChangeVersion* versions =
+            blockTable.load(std::memory_order_acquire)
+                ->changes[id / MatchBlockSize] +
+            (tracker * 2 + kind) * ChangeStride;
+        const std::size_t offset = id % MatchBlockSize;
+        versions[1 + BitplaneWords + offset].store(version,
+                                                   std::memory_order_relaxed);
+        raiseChangeVersion(versions[1 + offset / 64], version);
+        raiseChangeVersion(versions[0], version);
+    }
+
+    static void raiseChangeVersion(ChangeVersion& highest,
+                                   std::uint64_t version) {
+        std::uint64_t current = highest.load(std::memory_order_relaxed);
+        while (current < version &&
+               !highest.compare_exchange_weak(current, version,
+                                              std::memory_order_relaxed)) {
+        }
+    }
+
+    // Accessors of component storage that differ between dense columns and
+    // sparse columns (see EC::StoragePolicy).
+    template <typename ColumnType>
+    static auto getColumnElement(ColumnType& column, std::size_t index)
+        -> decltype(&column.at(index)) {
+        return &column.at(index);
+    }
+
+    template <typename T>
+    static T* getColumnElement(Internal::SparseColumn<T>& column,
+                               std::size_t index) {
+        return column.find(index);
+    }
+
+    template <typename ColumnType>
+    static auto getColumnElement(const ColumnType& column, std::size_t index)
+        -> decltype(&column.at(index)) {
+        return &column.at(index);
+    }
+
+    template <typename T>
+    static const T* getColumnElement(const Internal::SparseColumn<T>& column,
+                                     std::size_t index) {
+        return column.find(index);
+    }
+
+    template <typename ColumnType, typename T>
+    static void setColumnElement(ColumnType& column, std::size_t index,
+                                 T&& value) {
+        column[index] = std::forward<T>(value);
+    }
+
+    template <typename T>
+    static void setColumnElement(Internal::SparseColumn<T>& column,
+                                 std::size_t index, T&& value) {
+        column.insert(index, std::move(value));
+    }
+
+    template <typename ColumnType>
+    static void eraseColumnElement(ColumnType& /* column */,
+                                   std::size_t /* index */) {}
+
+    template <typename T>
+    static void eraseColumnElement(Internal::SparseColumn<T>& column,
+                                   std::size_t index) {
+        column.erase(index);
+    }
+
+    template <typename ColumnType>
+    static void clearColumn(ColumnType& /* column */) {}
+
+    template <typename T>
+    static void clearColumn(Internal::SparseColumn<T>& column) {
+        column.clear();
+    }
+
+   public:
+    /*!
+        \brief Marks an entity for deletion.
+
+        A deleted Entity's id is stored to be reclaimed later when
+        addEntity is called. Thus calling addEntity may return an id of
+        a previously deleted Entity.
+    */
+    void deleteEntity(std::size_t index) {
+        if (deferringDeletions.load() != 0) {
+            std::lock_guard<std::mutex> lock(deferredDeletionsMutex);
+            deferredDeletions.push_back(index);
+        } else {
+            deleteEntityImpl(index);
+        }
+    }
+
+    /*!
+        \brief Sets how many entities each ThreadPool task handles.
+
+        With the default grain size of 0, multi-threaded calls split the
+        entities into getThreadCount() * 2 equally sized sections. With a
+        non-zero grain size, the entities are split into sections of at most
+        that many entities, so there may be many more sections than threads.
+        The ThreadPool's work-stealing then balances the sections across
+        threads, which helps when the cost per entity is uneven. Smaller
+        grain sizes balance better but add more per-task overhead.
+    */
+    void setParallelGrainSize(std::size_t grainSize) {
+        parallelGrainSize = grainSize;
+    }
+
+    /*!
+        \brief Returns the grain size set with setParallelGrainSize().
+    */
+    std::size_t getParallelGrainSize() const { return parallelGrainSize; }
+
+    /*!
+        \brief Sets whether multi-threaded calls split the matching entities
+        instead of the range of entity IDs.
+
+        By default (false), forMatchingSignature(), forMatchingSignaturePtr(),
+        forMatchingSimple() and forMatchingIterable() split the range of
+        entity IDs into sections, and each section finds its own matching
+        entities. If the matching entities are clustered in one part of the
+        ID range, then one section ends up doing most of the work.
+
+        If true, then these functions first gather the matching entities on
+        the calling thread and split that list instead, so that each section
+        has the same number of matching entities.
+    */
+    void setParallelSplitByMatching(bool splitByMatching) {
+        parallelSplitByMatching = splitByMatching;
+    }
+
+    /*!
+        \brief Returns the value set with setParallelSplitByMatching().
+    */
+    bool isParallelSplitByMatching() const { return parallelSplitByMatching; }
+
+    /*!
+        \brief Enables or disables the archetype index.
+
+        When enabled, the Manager groups the IDs of alive entities by their
+        exact set of Components and Tags (their archetype), and keeps the
+        groups up to date as entities are added or deleted and as Components
+        and Tags are added or removed. This is only an index of entity IDs:
+        Components stay in their usual storage and are not moved into
+        per-archetype chunks. The "forMatching" functions and the stored
+        functions then only visit archetypes that contain the requested
+        Components and Tags, instead of checking every entity, so their cost
+        depends on the number of matching entities and archetypes rather than
+        on the number of entities.
+
+        This is worthwhile when queries match a small part of a large number
+        of entities, at the cost of some work on every change to an entity's
+        Components or Tags. It is disabled by default.
+
+        Each archetype has its own lock, which addEntity(), deleteEntity(),
+        addComponent(), removeComponent(), addTag() and removeTag() take for
+        the archetypes the entity leaves and joins. Callbacks of a
+        multi-threaded call thus only wait on each other when they move
+        entities out of or into the same archetype at the same time, or when
+        an entity joins an archetype that does not exist yet. Archetypes left
+        without entities are removed by the next call that gathers matching
+        entities.
+
+        When enabled, the matching entities are gathered before the function
+        is called on them, so entities that start or stop matching during the
+        call are not affected by the call.
+
+        This must not be called during a call to one of the "forMatching"
+        functions.
+    */
+    void setArchetypeIndexEnabled(bool enabled) {
+        archetypeIndexEnabled = enabled;
+        clearArchetypes();
+        if (enabled) {
+            entityArchetypes.resize(currentCapacity);
+            for (std::size_t i = 0; i < currentSize; ++i) {
+                if (std::get<bool>(entities[i])) {
+                    archetypeInsert(i);
+                }
+            }
+        }
+    }
+
+    /*!
+        \brief Returns whether the archetype index is enabled (see
+            setArchetypeIndexEnabled()).
+    */
+    bool isArchetypeIndexEnabled() const { return archetypeIndexEnabled; }
+
+    /*!
+        \brief Returns the number of archetypes in the archetype index (see
+            setArchetypeIndexEnabled()), which may include archetypes that
+            are left without entities until they are removed.
+    */
+    std::size_t getArchetypeCount() const {
+        std::shared_lock<std::shared_timed_mutex> lock(archetypeMutex);
+        return archetypes.size();
+    }
+
+    /*!
+        \brief Returns the current change tick.
+
+        Every change to a Component whose changes are tracked (see
+        EC::TrackChanges) is stamped with a tick: adding it with
+        addComponent() and marking it with markChanged() each use a new
+        tick, and each call to a "forMatching" function (or to view())
+        starts a new tick used for the EC::Mutable Components it accesses.
+        A Component changed after this function returned thus has a greater
+        tick than the returned one.
+
+        Give the returned tick to setChangeFilterTick() later to get only
+        the entities whose Components changed since, with EC::Changed and
+        EC::Added filters. Note that the tick should be taken outside of the
+        "forMatching" functions, as a change made later in the same call may
+        have the same tick.
+
+        Example:
+        \code{.cpp}
+            // every frame
+            manager.setChangeFilterTick(lastTick);
+            lastTick = manager.getChangeTick();
+            manager.forMatchingSignature<TypeList<EC::Changed<Transform>>>(
+                [] (std::size_t id, void* context, Transform* transform) {
+                    // send transform over the network
+                });
+        \endcode
+    */
+    std::uint64_t getChangeTick() const { return changeTick.load(); }
+
+    /*!
+        \brief Sets the tick that the EC::Changed and EC::Added filters
+            compare against.
+
+        Only Components changed (or added) after the given tick pass the
+        filters. The default is 0, where every Component an entity has
+        passes both filters.
+
+        This must not be called during a call to one of the "forMatching"
+        functions.
+    */
+    void setChangeFilterTick(std::uint64_t tick) { changeFilterTick = tick; }
+
+    /*!
+        \brief Returns the tick set with setChangeFilterTick().
+    */
+    std::uint64_t getChangeFilterTick() const { return changeFilterTick; }
+
+    /*!
+        \brief Marks the given Component of the given entity as changed.
+
+        Use this after changing a Component outside of a function using
+        EC::Mutable, such as through getEntityData(). Nothing happens if the
+        entity does not have the Component or if the changes of the
+        Component are not tracked (see EC::TrackChanges).
+    */
+    template <typename Component>
+    void markChanged(const std::size_t& entityID) {
+        if (!EC::TrackChanges<Component>::value ||
+            !EC::Meta::Contains<Component, Components>::value ||
+            !isAlive(entityID) || !hasComponent<Component>(entityID)) {
+            return;
+        }
+        setChangeVersion<Component>(entityID, ChangedVersion,
+                                    changeTick.fetch_add(1) + 1);
+    }
+
+   private:
+    // returns whether a call given the "useThreadPool" parameter runs on the
+    // ThreadPool, creating the internal ThreadPool on first use
+    bool usesThreadPool(bool useThreadPool) const {
+        if (!useThreadPool) {
+            return false;
+        }
+        if (threadPoolReady.load(std::memory_order_acquire)) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        if (!threadPool && internalThreadCount >= 2) {
+            threadPool =
+                std::make_shared<ThreadPoolType>(internalThreadCount);
+            threadPoolReady.store(true, std::memory_order_release);
+        }
+        return threadPool != nullptr;
+    }
+
+    // splits [0, size) into sections for the ThreadPool
+    void getChunkRanges(std::size_t size,
+                        std::vector<ChunkRange>& ranges) const {
+        std::size_t chunkCount;
+        if (parallelGrainSize == 0) {
+            chunkCount = std::min<std::size_t>(getThreadCount() * 2, size);
+        } else {
+            chunkCount = (size + parallelGrainSize - 1) / parallelGrainSize;
+        }
+
+        ranges.resize(chunkCount);
+        if (chunkCount == 0) {
+            return;
+        }
+        // spread the remainder over the first sections
+        const std::size_t s = size / chunkCount;
+        const std::size_t remainder = size % chunkCount;
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < chunkCount; ++i) {
+            const std::size_t end = begin + s + (i < remainder ? 1 : 0);
+            ranges[i] = {begin, end};
+            begin = end;
+        }
+    }
+
+    // the buffers of a multi-threaded call
+    struct ParallelScratch {
+        std::vector<ChunkRange> ranges;
+        AliveBitmapType alive;
+        std::vector<unsigned char> taskData;
+        // a std::vector of per-task objects of the type identified by
+        // taskObjectsType, kept for the next call using the same type
+        std::shared_ptr<void> taskObjects;
+        const void* taskObjectsType = nullptr;
+    };
+    // buffers returned by finished calls, so that a warmed up Manager does
+    // not allocate them for every call
+    mutable std::vector<std::unique_ptr<ParallelScratch> > freeScratch;
+    mutable std::mutex scratchMutex;
+
+    // Takes the buffers of a multi-threaded call from freeScratch and returns
+    // them when destroyed. Nested and concurrent calls each take their own.
+    class ScratchLease {
+       public:
+        explicit ScratchLease(const Manager& manager)
+            : manager(manager),
+              taskData(nullptr),
+              destroyTaskData(nullptr),
+              taskCount(0) {
+            std::lock_guard<std::mutex> lock(manager.scratchMutex);
+            if (manager.freeScratch.empty()) {
+                scratch = std::make_unique<ParallelScratch>();
+            } else {
+                scratch = std::move(manager.freeScratch.back());
+                manager.freeScratch.pop_back();
+            }
+        }
+
+        ~ScratchLease() {
+            if (destroyTaskData) {
+                destroyTaskData(taskData, taskCount);
+            }
+            std::lock_guard<std::mutex> lock(manager.scratchMutex);
+            manager.freeScratch.push_back(std::move(scratch));
+        }
+
+        ScratchLease(const ScratchLease&) = delete;
+        ScratchLease& operator=(const ScratchLease&) = delete;
+
+        // splits [0, size) into sections for the ThreadPool
+        const std::vector<ChunkRange>& getChunkRanges(std::size_t size) {
+            manager.getChunkRanges(size, scratch->ranges);
+            return scratch->ranges;
+        }
+
+        // the snapshot is left empty if "take" is false
+        const AliveBitmapType& getAliveSnapshot(bool take = true) {
+            if (take) {
+                manager.getAliveSnapshot(scratch->alive);
+            } else {
+                scratch->alive.clear();
+            }
+            return scratch->alive;
+        }
+
+        // returns "count" value initialized task data structs, destroyed
+        // with the lease (may be called once per lease)
+        template <typename T>
+        T* getTaskData(std::size_t count) {
+            std::vector<unsigned char>& buffer = scratch->taskData;
+            if (buffer.size() < count * sizeof(T) + alignof(T)) {
+                buffer.resize(count * sizeof(T) + alignof(T));
+            }
+            void* start = buffer.data();
+            std::size_t space = buffer.size();
+            T* data = static_cast<T*>(
+                std::align(alignof(T), count * sizeof(T), start, space));
+            for (std::size_t i = 0; i < count; ++i) {
+                new (data + i) T();
+            }
+            taskData = data;
+            taskCount = count;
+            destroyTaskData = [](void* array, std::size_t size) {
+                for (std::size_t i = 0; i < size; ++i) {
+                    static_cast<T*>(array)[i].~T();
+                }
+            };
+            return data;
+        }
+
+        // returns at least "count" objects of type T that are kept with the
+        // buffers after the lease, so that their own buffers are reused by
+        // the next call taking objects of the same type
+        template <typename T>
+        T* getTaskObjects(std::size_t count) {
+            static const char typeKey = 0;
+            if (scratch->taskObjectsType != &typeKey) {
+                scratch->taskObjects = std::make_shared<std::vector<T> >();
+                scratch->taskObjectsType = &typeKey;
+            }
+            std::vector<T>& objects =
+                *static_cast<std::vector<T>*>(scratch->taskObjects.get());
+            if (objects.size() < count) {
+                objects.resize(count);
+            }
+            return objects.data();
+        }
+
+       private:
+        const Manager& manager;
+        std::unique_ptr<ParallelScratch> scratch;
+        void* taskData;
+        void (*destroyTaskData)(void*, std::size_t);
+        std::size_t taskCount;
+    };
+
+    // whether the "forMatching" functions gather the matching entities
+    // before calling the function on them
+    bool gatherMatchingFirst(const bool useThreadPool) const {
+        return archetypeIndexEnabled ||
+               (usesThreadPool(useThreadPool) && parallelSplitByMatching);
+    }
+
+    // calls fn(id) on each entity in "matching", splitting "matching" into
+    // sections for the ThreadPool if it is used
+    template <typename Function>
+    void callOnMatching(const std::vector<std::size_t>& matching, Function& fn,
+                        const bool useThreadPool) {
+        if (!usesThreadPool(useThreadPool)) {
+            for (std::size_t id : matching) {
+                fn(id);
+            }
+            return;
+        }
+
+        ScratchLease scratch(*this);
+        const std::vector<ChunkRange>& ranges =
+            scratch.getChunkRanges(matching.size());
+        TPFnDataStructEight<Function>* fnDataAr =
+            scratch.template getTaskData<TPFnDataStructEight<Function>>(
+                ranges.size());
+        TPBatch batch;
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            fnDataAr[i].range = ranges[i];
+            fnDataAr[i].matching = &matching;
+            fnDataAr[i].fn = &fn;
+            threadPool->queueFn(
+                [](void* ud) {
+                    auto* data =
+                        static_cast<TPFnDataStructEight<Function>*>(ud);
+                    for (std::size_t i = data->range[0]; i < data->range[1];
+                         ++i) {
+                        (*data->fn)((*data->matching)[i]);
+                    }
+                },
+                &fnDataAr[i], batch);
+        }
+        threadPool->easyStartAndWait(batch);
+    }
+
+    // each call of a "forMatching" function starts a new change tick, so
+    // that EC::Mutable Components it changes are newer than the ticks
+    // returned by getChangeTick() before the call
+    void startChangeTick() { changeTick.fetch_add(1); }
+
+    // push to idStack "call stack"
+    std::size_t pushIdStack() {
+        startChangeTick();
+        std::lock_guard<std::mutex> lock(idStackMutex);
+        idStack.push_back(idStackCounter);
+        return idStackCounter++;
+    }
+
+    // pop from idStack "call stack", blocking until the given id is on top
+    void popIdStack(std::size_t id) {
+        {
+            std::unique_lock<std::mutex> lock(idStackMutex);
+            idStackCV.wait(lock, [this, id]() { return idStack.back() == id; });
+            idStack.pop_back();
+        }
+        idStackCV.notify_all();
+    }
+
+    void handleDeferredDeletions() {
+        if (deferringDeletions.fetch_sub(1) == 1) {
             std::lock_guard<std::mutex> lock(deferredDeletionsMutex);
             for (std::size_t id : deferredDeletions) {
                 deleteEntityImpl(id);
@@ -332,6 +2009,15 @@ struct Manager {
     */
     std::size_t getCurrentCapacity() const { return currentCapacity; }
 
+    /*!
+        \brief Ensures that the Manager can hold at least the given number of
+            entities without growing.
+
+        With EC::ContiguousStorage, pointers to components stay valid until
+        the number of entities exceeds the reserved capacity.
+    */
+    void reserve(std::size_t capacity) { resize(capacity); }
+
     /*!
         \brief Returns a const reference to an Entity's info.
 
@@ -357,6 +2043,10 @@ struct Manager {
 
         If the given Component is unknown to the Manager, then this function
         will return a nullptr.
+
+        If the given Component uses EC::SparseStoragePolicy (see
+        EC::StoragePolicy), then this function will return a nullptr if the
+        Entity doesn't own the Component.
     */
     template <typename Component>
     Component* getEntityData(const std::size_t& index) {
@@ -366,8 +2056,8 @@ struct Manager {
             // Cast required due to compiler thinking that an invalid
             // Component is needed even though the enclosing if statement
             // prevents this from ever happening.
-            return (Component*)&std::get<componentIndex>(componentsStorage)
-                .at(index);
+            return (Component*)getColumnElement(
+                std::get<componentIndex>(componentsStorage), index);
         } else {
             return nullptr;
         }
@@ -387,6 +2077,10 @@ struct Manager {
 
         If the given Component is unknown to the Manager, then this function
         will return a nullptr.
+
+        If the given Component uses EC::SparseStoragePolicy (see
+        EC::StoragePolicy), then this function will return a nullptr if the
+        Entity doesn't own the Component.
     */
     template <typename Component>
     Component* getEntityComponent(const std::size_t& index) {
@@ -405,6 +2099,10 @@ struct Manager {
 
         If the given Component is unknown to the Manager, then this function
         will return a nullptr.
+
+        If the given Component uses EC::SparseStoragePolicy (see
+        EC::StoragePolicy), then this function will return a nullptr if the
+        Entity doesn't own the Component.
     */
     template <typename Component>
     const Component* getEntityData(const std::size_t& index) const {
@@ -414,8 +2112,8 @@ struct Manager {
             // Cast required due to compiler thinking that an invalid
             // Component is needed even though the enclosing if statement
             // prevents this from ever happening.
-            return (Component*)&std::get<componentIndex>(componentsStorage)
-                .at(index);
+            return (Component*)getColumnElement(
+                std::get<componentIndex>(componentsStorage), index);
         } else {
             return nullptr;
         }
@@ -435,6 +2133,10 @@ struct Manager {
 
         If the given Component is unknown to the Manager, then this function
         will return a nullptr.
+
+        If the given Component uses EC::SparseStoragePolicy (see
+        EC::StoragePolicy), then this function will return a nullptr if the
+        Entity doesn't own the Component.
     */
     template <typename Component>
     const Component* getEntityComponent(const std::size_t& index) const {
@@ -508,16 +2210,25 @@ struct Manager {
 
         Component component(std::forward<Args>(args)...);
 
-        std::get<BitsetType>(entities[entityID])
-            .template getComponentBit<Component>() = true;
-
         constexpr auto index = EC::Meta::IndexOf<Component, Components>::value;
-
-        // Cast required due to compiler thinking that deque<char> at
+        if (EC::TrackChanges<Component>::value) {
+            const std::uint64_t version = changeTick.fetch_add(1) + 1;
+            if (!hasComponent<Component>(entityID)) {
+                setChangeVersion<Component>(entityID, AddedVersion, version);
+            }
+            setChangeVersion<Component>(entityID, ChangedVersion, version);
+        }
+        // Cast required due to compiler thinking that Column<char> at
         // index = Components::size is being used, even if the previous
         // if statement will prevent this from ever happening.
-        (*((std::deque<Component>*)(&std::get<index>(
-            componentsStorage))))[entityID] = std::move(component);
+        setColumnElement(*((ComponentColumn<Component>*)(&std::get<index>(
+                             componentsStorage))),
+                         entityID, std::move(component));
+
+        // The Component is stored before its bit is set, so a concurrent
+        // scan that matches the entity finds it (see removeComponent()).
+        setEntityBit(entityID, EC::Meta::IndexOf<Component, Combined>::value,
+                     true);
     }
 
     /*!
@@ -538,8 +2249,15 @@ struct Manager {
             return;
         }
 
-        std::get<BitsetType>(entities[entityID])
-            .template getComponentBit<Component>() = false;
+        setEntityBit(entityID, EC::Meta::IndexOf<Component, Combined>::value,
+                     false);
+
+        constexpr auto index = EC::Meta::IndexOf<Component, Components>::value;
+
+        // Cast required for the same reason as in addComponent().
+        eraseColumnElement(*((ComponentColumn<Component>*)(&std::get<index>(
+                               componentsStorage))),
+                           entityID);
     }
 
     /*!
@@ -556,8 +2274,7 @@ struct Manager {
             return;
         }
 
-        std::get<BitsetType>(entities[entityID]).template getTagBit<Tag>() =
-            true;
+        setEntityBit(entityID, EC::Meta::IndexOf<Tag, Combined>::value, true);
     }
 
     /*!
@@ -576,8 +2293,7 @@ struct Manager {
             return;
         }
 
-        std::get<BitsetType>(entities[entityID]).template getTagBit<Tag>() =
-            false;
+        setEntityBit(entityID, EC::Meta::IndexOf<Tag, Combined>::value, false);
     }
 
     /*!
@@ -586,6 +2302,9 @@ struct Manager {
         Some data may persist but will be overwritten when new entities
         are added. Thus, do not depend on data to persist after a call to
         reset().
+
+        reset() invalidates all Views (see view()) and their iterators,
+        as they refer to the bitplane blocks it frees.
     */
     void reset() {
         clearForMatchingFunctions();
@@ -593,6 +2312,16 @@ struct Manager {
         currentSize = 0;
         currentCapacity = 0;
         deletedSet.clear();
+        clearArchetypes();
+        // reallocated cleared by resize()
+        bitplaneBlocks.clear();
+        changeBlocks.clear();
+        blockTable.store(nullptr);
+        blockTables.clear();
+        EC::Meta::forEach<ComponentsList>([this](auto t) {
+            clearColumn(std::get<ComponentColumn<decltype(t)> >(
+                this->componentsStorage));
+        });
         resize(EC_INIT_ENTITIES_SIZE);
 
         std::lock_guard<std::mutex> lock(deferredDeletionsMutex);
@@ -601,20 +2330,79 @@ struct Manager {
     }
 
    private:
+    // gets a Component given to the function called by the "forMatching"
+    // functions, or nullptr for an EC::Optional Component the entity does
+    // not have, and marks an EC::Mutable Component as changed
+    template <typename Component>
+    Component* getSignatureParameter(std::size_t entityID, Component*) {
+        return getEntityData<Component>(entityID);
+    }
+
+    template <typename Component>
+    Component* getSignatureParameter(std::size_t entityID,
+                                     EC::Optional<Component>*) {
+        return hasComponent<Component>(entityID)
+                   ? getEntityData<Component>(entityID)
+                   : nullptr;
+    }
+
+    template <typename Component>
+    Component* getSignatureParameter(std::size_t entityID,
+                                     EC::Changed<Component>*) {
+        return getEntityData<Component>(entityID);
+    }
+
+    template <typename Component>
+    Component* getSignatureParameter(std::size_t entityID,
+                                     EC::Added<Component>*) {
+        return getEntityData<Component>(entityID);
+    }
+
+    template <typename Component>
+    Component* getSignatureParameter(std::size_t entityID,
+                                     EC::Mutable<Component>* mutableType) {
+        markMutableChanged(entityID, mutableType);
+        return getEntityData<Component>(entityID);
+    }
+
+    // marks an EC::Mutable Component given to a called function as changed,
+    // unless another thread removed it since the entity matched
+    template <typename Type>
+    void markMutableChanged(std::size_t, Type*) {}
+
+    template <typename Component>
+    void markMutableChanged(std::size_t entityID, EC::Mutable<Component>*) {
+        if (hasComponent<Component>(entityID)) {
+            setChangeVersion<Component>(
+                entityID, ChangedVersion,
+                changeTick.load(std::memory_order_relaxed));
+        }
+    }
+
     template <typename... Types>
     struct ForMatchingSignatureHelper {
         template <typename CType, typename Function>
         static void call(const std::size_t& entityID, CType& ctype,
                          Function&& function, void* userData = nullptr) {
             function(entityID, userData,
-                     ctype.template getEntityData<Types>(entityID)...);
+                     ctype.getSignatureParameter(
+                         entityID, static_cast<Types*>(nullptr))...);
         }
 
         template <typename CType, typename Function>
         static void callPtr(const std::size_t& entityID, CType& ctype,
                             Function* function, void* userData = nullptr) {
             (*function)(entityID, userData,
-                        ctype.template getEntityData<Types>(entityID)...);
+                        ctype.getSignatureParameter(
+                            entityID, static_cast<Types*>(nullptr))...);
+        }
+
+        template <typename CType, typename Function>
+        static auto map(const std::size_t& entityID, CType& ctype,
+                        Function& function) {
+            return function(entityID,
+                            ctype.getSignatureParameter(
+                                entityID, static_cast<Types*>(nullptr))...);
         }
 
         template <typename CType, typename Function>
@@ -644,6 +2432,10 @@ struct Manager {
         Signature are only used as filters and will not be given as a
         parameter to the function.
 
+        The Signature may also contain EC::Without<T> to skip entities that
+        have T, and EC::Optional<C> for a Component parameter that is nullptr
+        for entities without C.
+
         The second parameter is default nullptr and will be passed to the
         function call as the second parameter as a means of providing
         context (useful when the function is not a lambda function).
@@ -676,93 +2468,69 @@ struct Manager {
     template <typename Signature, typename Function>
     void forMatchingSignature(Function&& function, void* userData = nullptr,
                               const bool useThreadPool = false) {
-        std::size_t current_id;
-        {
-            // push to idStack "call stack"
-            std::lock_guard<std::mutex> lock(idStackMutex);
-            current_id = idStackCounter++;
-            idStack.push_back(current_id);
-        }
+        const std::size_t current_id = pushIdStack();
         deferringDeletions.fetch_add(1);
         using SignatureComponents =
-            typename EC::Meta::Matching<Signature, ComponentsList>::type;
+            typename Internal::SignatureParameters<Signature,
+                                                   ComponentsList>::type;
         using Helper =
             EC::Meta::Morph<SignatureComponents, ForMatchingSignatureHelper<> >;
 
-        BitsetType signatureBitset =
-            BitsetType::template generateBitset<Signature>();
-        if (!useThreadPool || !threadPool) {
-            for (std::size_t i = 0; i < currentSize; ++i) {
-                if (!std::get<bool>(entities[i])) {
-                    continue;
-                }
-
-                if ((signatureBitset & std::get<BitsetType>(entities[i])) ==
-                    signatureBitset) {
-                    Helper::call(i, *this, std::forward<Function>(function),
-                                 userData);
-                }
-            }
+        SignatureBitsets signatureBitset =
+            generateSignatureBitsets<Signature>();
+        if (gatherMatchingFirst(useThreadPool)) {
+            const std::vector<std::size_t> matching =
+                getMatchingEntities({&signatureBitset}, useThreadPool)[0];
+            auto callFn = [this, &function, userData](std::size_t id) {
+                Helper::call(id, *this, std::forward<Function>(function),
+                             userData);
+            };
+            callOnMatching(matching, callFn, useThreadPool);
+        } else if (!usesThreadPool(useThreadPool)) {
+            const MatchScan scan = getMatchScan(signatureBitset);
+            scanMatching(scan, 0, currentSize,
+                         [this, &function, userData](std::size_t id) {
+                             Helper::call(id, *this,
+                                          std::forward<Function>(function),
+                                          userData);
+                         });
         } else {
-            std::array<TPFnDataStructZero, ThreadCount * 2> fnDataAr;
-
-            std::size_t s = currentSize / (ThreadCount * 2);
-            for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                std::size_t begin = s * i;
-                std::size_t end;
-                if (i == ThreadCount * 2 - 1) {
-                    end = currentSize;
-                } else {
-                    end = s * (i + 1);
-                }
-                if (begin == end) {
-                    continue;
-                }
-                fnDataAr[i].range = {begin, end};
+            ScratchLease scratch(*this);
+            const std::vector<ChunkRange>& ranges =
+                scratch.getChunkRanges(currentSize);
+            const AliveBitmapType& aliveSnapshot = scratch.getAliveSnapshot();
+            const MatchScan scan = getMatchScan(signatureBitset);
+            TPFnDataStructZero* fnDataAr =
+                scratch.template getTaskData<TPFnDataStructZero>(ranges.size());
+            TPBatch batch;
+
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                fnDataAr[i].range = ranges[i];
                 fnDataAr[i].manager = this;
-                fnDataAr[i].entities = &entities;
-                fnDataAr[i].signature = &signatureBitset;
+                fnDataAr[i].scan = &scan;
                 fnDataAr[i].userData = userData;
-                for (std::size_t j = begin; j < end; ++j) {
-                    if (!isAlive(j)) {
-                        fnDataAr[i].dead.insert(j);
-                    }
-                }
+                fnDataAr[i].alive = &aliveSnapshot;
 
                 threadPool->queueFn(
                     [&function](void* ud) {
                         auto* data = static_cast<TPFnDataStructZero*>(ud);
-                        for (std::size_t i = data->range[0]; i < data->range[1];
-                             ++i) {
-                            if (data->dead.find(i) != data->dead.end()) {
-                                continue;
-                            }
-
-                            if (((*data->signature) &
-                                 std::get<BitsetType>(data->entities->at(i))) ==
-                                *data->signature) {
-                                Helper::call(i, *data->manager,
-                                             std::forward<Function>(function),
-                                             data->userData);
-                            }
-                        }
+                        data->manager->scanMatching(
+                            *data->scan, data->range[0], data->range[1],
+                            [data, &function](std::size_t id) {
+                                if (isAliveIn(*data->alive, id)) {
+                                    Helper::call(
+                                        id, *data->manager,
+                                        std::forward<Function>(function),
+                                        data->userData);
+                                }
+                            });
                     },
-                    &fnDataAr[i]);
+                    &fnDataAr[i], batch);
             }
-            threadPool->easyStartAndWait();
+            threadPool->easyStartAndWait(batch);
         }
 
-        // pop from idStack "call stack"
-        do {
-            {
-                std::lock_guard<std::mutex> lock(idStackMutex);
-                if (idStack.back() == current_id) {
-                    idStack.pop_back();
-                    break;
-                }
-            }
-            std::this_thread::sleep_for(std::chrono::microseconds(15));
-        } while (true);
+        popIdStack(current_id);
 
         handleDeferredDeletions();
     }
@@ -811,103 +2579,869 @@ struct Manager {
     template <typename Signature, typename Function>
     void forMatchingSignaturePtr(Function* function, void* userData = nullptr,
                                  const bool useThreadPool = false) {
-        std::size_t current_id;
-        {
-            // push to idStack "call stack"
-            std::lock_guard<std::mutex> lock(idStackMutex);
-            current_id = idStackCounter++;
-            idStack.push_back(current_id);
+        const std::size_t current_id = pushIdStack();
+        deferringDeletions.fetch_add(1);
+        using SignatureComponents =
+            typename Internal::SignatureParameters<Signature,
+                                                   ComponentsList>::type;
+        using Helper =
+            EC::Meta::Morph<SignatureComponents, ForMatchingSignatureHelper<> >;
+
+        SignatureBitsets signatureBitset =
+            generateSignatureBitsets<Signature>();
+        if (gatherMatchingFirst(useThreadPool)) {
+            const std::vector<std::size_t> matching =
+                getMatchingEntities({&signatureBitset}, useThreadPool)[0];
+            auto callFn = [this, function, userData](std::size_t id) {
+                Helper::callPtr(id, *this, function, userData);
+            };
+            callOnMatching(matching, callFn, useThreadPool);
+        } else if (!usesThreadPool(useThreadPool)) {
+            const MatchScan scan = getMatchScan(signatureBitset);
+            scanMatching(scan, 0, currentSize,
+                         [this, function, userData](std::size_t id) {
+                             Helper::callPtr(id, *this, function, userData);
+                         });
+        } else {
+            ScratchLease scratch(*this);
+            const std::vector<ChunkRange>& ranges =
+                scratch.getChunkRanges(currentSize);
+            const AliveBitmapType& aliveSnapshot = scratch.getAliveSnapshot();
+            const MatchScan scan = getMatchScan(signatureBitset);
+            TPFnDataStructOne<Function>* fnDataAr =
+                scratch.template getTaskData<TPFnDataStructOne<Function>>(
+                    ranges.size());
+            TPBatch batch;
+
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                fnDataAr[i].range = ranges[i];
+                fnDataAr[i].manager = this;
+                fnDataAr[i].scan = &scan;
+                fnDataAr[i].userData = userData;
+                fnDataAr[i].fn = function;
+                fnDataAr[i].alive = &aliveSnapshot;
+                threadPool->queueFn(
+                    [](void* ud) {
+                        auto* data =
+                            static_cast<TPFnDataStructOne<Function>*>(ud);
+                        data->manager->scanMatching(
+                            *data->scan, data->range[0], data->range[1],
+                            [data](std::size_t id) {
+                                if (isAliveIn(*data->alive, id)) {
+                                    Helper::callPtr(id, *data->manager,
+                                                    data->fn, data->userData);
+                                }
+                            });
+                    },
+                    &fnDataAr[i], batch);
+            }
+            threadPool->easyStartAndWait(batch);
+        }
+
+        popIdStack(current_id);
+
+        handleDeferredDeletions();
+    }
+
+   private:
+    template <bool... Values>
+    using AllOf = std::is_same<std::integer_sequence<bool, true, Values...>,
+                               std::integer_sequence<bool, Values..., true> >;
+
+    // collects matching entities into chunks for forMatchingChunks(), given
+    // the Components of the Signature (C or EC::Mutable<C>)
+    template <typename... Types>
+    struct ForMatchingChunksHelper {
+        static_assert(
+            AllOf<Internal::IsChunkParameter<Types, ComponentsList>::value...>::
+                value,
+            "EC::Optional and the Component filters other than EC::Mutable "
+            "are not supported by forMatchingChunks()");
+
+        template <typename Type>
+        using ComponentOf = typename Internal::RequiredBy<Type>::type;
+
+        // Components in aligned columns are given as pointers into the
+        // columns, which requires chunks of consecutive entity IDs. Other
+        // Components are moved into "gathered" while the function runs.
+        static constexpr bool Direct =
+            sizeof...(Types) > 0 &&
+            AllOf<std::is_same<
+                ComponentColumn<ComponentOf<Types> >,
+                Internal::AlignedColumn<ComponentOf<Types> > >::value...>::
+                value;
+
+        std::vector<std::size_t> ids;
+        std::tuple<std::vector<ComponentOf<Types> >...> gathered;
+
+        template <typename Function>
+        void add(std::size_t id, Manager& manager, Function& function,
+                 void* userData) {
+            if (ids.size() == EC_CHUNK_SIZE ||
+                (Direct && !ids.empty() && ids.back() + 1 != id)) {
+                flush(manager, function, userData);
+            }
+            ids.push_back(id);
+        }
+
+        template <typename Function>
+        void flush(Manager& manager, Function& function, void* userData) {
+            if (!ids.empty()) {
+                using Expand = int[];
+                for (std::size_t id : ids) {
+                    (void)Expand{0, (manager.markMutableChanged(
+                                         id, static_cast<Types*>(nullptr)),
+                                     0)...};
+                }
+                call(manager, function, userData,
+                     std::integral_constant<bool, Direct>{});
+                ids.clear();
+            }
+        }
+
+        template <typename Function>
+        void call(Manager& manager, Function& function, void* userData,
+                  std::true_type) {
+            function(
+                ids.data(), ids.size(), userData,
+                manager.template getEntityData<ComponentOf<Types> >(ids[0])...);
+        }
+
+        template <typename Function>
+        void call(Manager& manager, Function& function, void* userData,
+                  std::false_type) {
+            using Expand = int[];
+            (void)Expand{0, (gather<ComponentOf<Types> >(manager), 0)...};
+            function(ids.data(), ids.size(), userData,
+                     std::get<std::vector<ComponentOf<Types> > >(gathered)
+                         .data()...);
+            (void)Expand{0, (scatter<ComponentOf<Types> >(manager), 0)...};
+        }
+
+        template <typename Component>
+        void gather(Manager& manager) {
+            std::vector<Component>& components =
+                std::get<std::vector<Component> >(gathered);
+            components.clear();
+            for (std::size_t id : ids) {
+                components.push_back(std::move(
+                    *manager.template getEntityData<Component>(id)));
+            }
+        }
+
+        template <typename Component>
+        void scatter(Manager& manager) {
+            std::vector<Component>& components =
+                std::get<std::vector<Component> >(gathered);
+            for (std::size_t i = 0; i < ids.size(); ++i) {
+                // a sparse Component may have been removed by the function
+                Component* component =
+                    manager.template getEntityData<Component>(ids[i]);
+                if (component) {
+                    *component = std::move(components[i]);
+                }
+            }
+            components.clear();
         }
+    };
+
+   public:
+    /*!
+        \brief Calls the given function on chunks of Entities matching the
+            given Signature.
+
+        Instead of calling the function once per entity like
+        forMatchingSignature(), the function is given up to EC_CHUNK_SIZE
+        entities at a time, so that its body can loop over arrays of
+        Components (and be vectorized by the compiler).
+
+        The function must accept a const std::size_t* of entity IDs as its
+        first parameter, the number of entities in the chunk as its second
+        parameter, void* as its third parameter, and a pointer to an array of
+        each Component of the Signature for the rest of the parameters. For
+        every i less than the count, the i-th element of a Component array
+        is the Component of the entity at ids[i]. Tags and EC::Without filters
+        are only used to filter entities. A Component given as EC::Mutable
+        is given as an array of the Component and marked as changed for
+        every entity of the chunk, while the other Component filters such as
+        EC::Optional or EC::Changed are not supported.
+
+        With EC::ContiguousStorage, the arrays point directly into the
+        Component storage and each chunk has consecutive entity IDs.
+        Otherwise, the Components of a chunk are moved into temporary arrays
+        before the call and moved back afterwards. In both cases, the
+        function must only access the Components of entities in the chunk
+        through the given arrays.
+
+        Without EC::ContiguousStorage, the Components left in the storage
+        are moved-from objects while a chunk's call runs. So nothing (neither
+        the calls on other chunks in parallel nor other threads) may access
+        the entities of a chunk through the Manager (such as with
+        getEntityData() or getEntityComponent()) during its call.
+
+        The third parameter can be optionally used to enable the use of the
+        internal ThreadPool, in which case chunks are processed in parallel.
+
+        Example:
+        \code{.cpp}
+            manager.forMatchingChunks<TypeList<Position, Velocity>>([]
+                (const std::size_t* ids, std::size_t count, void* context,
+                Position* positions, Velocity* velocities)
+            {
+                for (std::size_t i = 0; i < count; ++i) {
+                    positions[i].x += velocities[i].x;
+                }
+            });
+        \endcode
+    */
+    template <typename Signature, typename Function>
+    void forMatchingChunks(Function&& function, void* userData = nullptr,
+                           const bool useThreadPool = false) {
+        using SignatureComponents =
+            typename Internal::SignatureParameters<Signature,
+                                                   ComponentsList>::type;
+        using Chunks = EC::Meta::Morph<SignatureComponents,
+                                       ForMatchingChunksHelper<> >;
+
+        const std::size_t current_id = pushIdStack();
         deferringDeletions.fetch_add(1);
+        const SignatureBitsets signatureBitset =
+            generateSignatureBitsets<Signature>();
+
+        if (gatherMatchingFirst(useThreadPool)) {
+            const std::vector<std::size_t> matching =
+                getMatchingEntities({&signatureBitset}, useThreadPool)[0];
+            if (!usesThreadPool(useThreadPool)) {
+                Chunks chunks;
+                for (std::size_t id : matching) {
+                    chunks.add(id, *this, function, userData);
+                }
+                chunks.flush(*this, function, userData);
+            } else {
+                using DataType = TPFnDataStructTen<Chunks>;
+                ScratchLease scratch(*this);
+                const std::vector<ChunkRange>& ranges =
+                    scratch.getChunkRanges(matching.size());
+                DataType* fnDataAr =
+                    scratch.template getTaskData<DataType>(ranges.size());
+                Chunks* chunksAr =
+                    scratch.template getTaskObjects<Chunks>(ranges.size());
+                TPBatch batch;
+
+                for (std::size_t i = 0; i < ranges.size(); ++i) {
+                    fnDataAr[i].range = ranges[i];
+                    fnDataAr[i].manager = this;
+                    fnDataAr[i].scan = nullptr;
+                    fnDataAr[i].userData = userData;
+                    fnDataAr[i].matching = &matching;
+                    fnDataAr[i].alive = nullptr;
+                    fnDataAr[i].chunks = &chunksAr[i];
+                    threadPool->queueFn(
+                        [&function](void* ud) {
+                            auto* data = static_cast<DataType*>(ud);
+                            for (std::size_t i = data->range[0];
+                                 i < data->range[1]; ++i) {
+                                data->chunks->add((*data->matching)[i],
+                                                  *data->manager, function,
+                                                  data->userData);
+                            }
+                            data->chunks->flush(*data->manager, function,
+                                                data->userData);
+                        },
+                        &fnDataAr[i], batch);
+                }
+                threadPool->easyStartAndWait(batch);
+            }
+        } else if (!usesThreadPool(useThreadPool)) {
+            Chunks chunks;
+            scanMatching(getMatchScan(signatureBitset), 0, currentSize,
+                         [this, &chunks, &function, userData](std::size_t id) {
+                             chunks.add(id, *this, function, userData);
+                         });
+            chunks.flush(*this, function, userData);
+        } else {
+            using DataType = TPFnDataStructTen<Chunks>;
+            ScratchLease scratch(*this);
+            const std::vector<ChunkRange>& ranges =
+                scratch.getChunkRanges(currentSize);
+            const AliveBitmapType& aliveSnapshot = scratch.getAliveSnapshot();
+            const MatchScan scan = getMatchScan(signatureBitset);
+            DataType* fnDataAr =
+                scratch.template getTaskData<DataType>(ranges.size());
+            Chunks* chunksAr =
+                scratch.template getTaskObjects<Chunks>(ranges.size());
+            TPBatch batch;
+
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                fnDataAr[i].range = ranges[i];
+                fnDataAr[i].manager = this;
+                fnDataAr[i].scan = &scan;
+                fnDataAr[i].userData = userData;
+                fnDataAr[i].matching = nullptr;
+                fnDataAr[i].alive = &aliveSnapshot;
+                fnDataAr[i].chunks = &chunksAr[i];
+                threadPool->queueFn(
+                    [&function](void* ud) {
+                        auto* data = static_cast<DataType*>(ud);
+                        data->manager->scanMatching(
+                            *data->scan, data->range[0], data->range[1],
+                            [data, &function](std::size_t id) {
+                                if (isAliveIn(*data->alive, id)) {
+                                    data->chunks->add(id, *data->manager,
+                                                      function,
+                                                      data->userData);
+                                }
+                            });
+                        data->chunks->flush(*data->manager, function,
+                                            data->userData);
+                    },
+                    &fnDataAr[i], batch);
+            }
+            threadPool->easyStartAndWait(batch);
+        }
+
+        popIdStack(current_id);
+
+        handleDeferredDeletions();
+    }
+
+    /*!
+        \brief Combines a value computed from each entity matching the given
+            Signature.
+
+        The first function is called on each matching entity with its ID and
+        Component pointers (like the "forMatching" functions, but without the
+        void* context), and returns a value for the entity. The second
+        function combines two values into one. Without the ThreadPool the
+        result is
+
+            combineFn(...combineFn(combineFn(init, map0), map1)..., mapN)
+
+        in order of entity ID.
+
+        If the fourth parameter is true, then each section of entities is
+        combined on its own with the ThreadPool, without any lock, and the
+        values of the sections are then combined with init in order of the
+        sections. The result is then the same for the same entities and
+        sections, but combineFn should be associative for it to equal the
+        result without the ThreadPool.
+
+        Example:
+        \code{.cpp}
+            float totalMass = manager.forMatchingReduce<TypeList<Mass>>(
+                0.0f,
+                [] (std::size_t id, Mass* mass) { return mass->value; },
+                [] (float a, float b) { return a + b; },
+                true);
+        \endcode
+    */
+    template <typename Signature, typename T, typename MapFn,
+              typename CombineFn>
+    T forMatchingReduce(T init, MapFn mapFn, CombineFn combineFn,
+                        const bool useThreadPool = false) {
         using SignatureComponents =
-            typename EC::Meta::Matching<Signature, ComponentsList>::type;
+            typename Internal::SignatureParameters<Signature,
+                                                   ComponentsList>::type;
         using Helper =
             EC::Meta::Morph<SignatureComponents, ForMatchingSignatureHelper<> >;
+        using DataType = TPFnDataStructSeven<T, MapFn, CombineFn>;
 
-        BitsetType signatureBitset =
-            BitsetType::template generateBitset<Signature>();
-        if (!useThreadPool || !threadPool) {
-            for (std::size_t i = 0; i < currentSize; ++i) {
-                if (!std::get<bool>(entities[i])) {
-                    continue;
+        const std::size_t current_id = pushIdStack();
+        deferringDeletions.fetch_add(1);
+        const SignatureBitsets signatureBitset =
+            generateSignatureBitsets<Signature>();
+        const bool gather = gatherMatchingFirst(useThreadPool);
+        const std::vector<std::size_t> matching =
+            gather ? getMatchingEntities({&signatureBitset}, useThreadPool)[0]
+                   : std::vector<std::size_t>{};
+        const MatchScan scan = gather ? MatchScan{}
+                                      : getMatchScan(signatureBitset);
+
+        T result = std::move(init);
+        if (!usesThreadPool(useThreadPool)) {
+            auto reduceFn = [this, &result, &mapFn,
+                             &combineFn](std::size_t id) {
+                result = combineFn(std::move(result),
+                                   Helper::map(id, *this, mapFn));
+            };
+            if (gather) {
+                for (std::size_t id : matching) {
+                    reduceFn(id);
+                }
+            } else {
+                scanMatching(scan, 0, currentSize, reduceFn);
+            }
+        } else {
+            ScratchLease scratch(*this);
+            const std::vector<ChunkRange>& ranges =
+                scratch.getChunkRanges(gather ? matching.size() : currentSize);
+            const AliveBitmapType& aliveSnapshot = scratch.getAliveSnapshot();
+            DataType* fnDataAr =
+                scratch.template getTaskData<DataType>(ranges.size());
+            TPBatch batch;
+
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                fnDataAr[i].range = ranges[i];
+                fnDataAr[i].manager = this;
+                fnDataAr[i].scan = &scan;
+                fnDataAr[i].matching = gather ? &matching : nullptr;
+                fnDataAr[i].mapFn = &mapFn;
+                fnDataAr[i].combineFn = &combineFn;
+                fnDataAr[i].alive = &aliveSnapshot;
+                threadPool->queueFn(
+                    [](void* ud) {
+                        auto* data = static_cast<DataType*>(ud);
+                        auto reduceFn = [data](std::size_t id) {
+                            if (!isAliveIn(*data->alive, id)) {
+                                return;
+                            }
+                            T value =
+                                Helper::map(id, *data->manager, *data->mapFn);
+                            if (data->partial) {
+                                *data->partial = (*data->combineFn)(
+                                    std::move(*data->partial),
+                                    std::move(value));
+                            } else {
+                                data->partial.reset(new T(std::move(value)));
+                            }
+                        };
+                        if (data->matching) {
+                            for (std::size_t i = data->range[0];
+                                 i < data->range[1]; ++i) {
+                                reduceFn((*data->matching)[i]);
+                            }
+                        } else {
+                            data->manager->scanMatching(
+                                *data->scan, data->range[0], data->range[1],
+                                reduceFn);
+                        }
+                    },
+                    &fnDataAr[i], batch);
+            }
+            threadPool->easyStartAndWait(batch);
+
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                DataType& data = fnDataAr[i];
+                if (data.partial) {
+                    result =
+                        combineFn(std::move(result), std::move(*data.partial));
                 }
+            }
+        }
+
+        popIdStack(current_id);
+
+        handleDeferredDeletions();
+        return result;
+    }
+
+   private:
+    // the element of a View's value for a type given by SignatureParameters
+    template <typename T>
+    struct ViewElement {
+        using type = typename Internal::RequiredBy<T>::type&;
+
+        static type get(Manager& manager, std::size_t entityID) {
+            return *manager.getSignatureParameter(entityID,
+                                                  static_cast<T*>(nullptr));
+        }
+    };
+
+    template <typename Component>
+    struct ViewElement<EC::Optional<Component> > {
+        using type = Component*;
+
+        static type get(Manager& manager, std::size_t entityID) {
+            return manager.getSignatureParameter(
+                entityID, static_cast<EC::Optional<Component>*>(nullptr));
+        }
+    };
+
+    template <typename... Types>
+    struct ViewValueHelper {
+        using type =
+            std::tuple<std::size_t, typename ViewElement<Types>::type...>;
+
+        static type get(Manager& manager, std::size_t entityID) {
+            return type(entityID,
+                        ViewElement<Types>::get(manager, entityID)...);
+        }
+    };
+
+   public:
+    /*!
+        \brief A range over the entities matching a Signature, as returned
+            by view().
+
+        Iterating yields a std::tuple of the entity ID followed by a
+        reference to each Component of the Signature (or a pointer for an
+        EC::Optional Component, which is nullptr if the entity does not have
+        it). Tags and EC::Without filters are only used to filter entities.
+
+        A View covers the entity IDs that existed when it was created.
+        Entities are checked again when the iterator reaches them, so
+        entities that were deleted or stopped matching are skipped.
+
+        For parallel use, split() divides the range of IDs into Views that
+        may be iterated on different threads.
+
+        A View and its iterators are invalidated by reset() of the Manager,
+        and must not be used afterwards.
+    */
+    template <typename Signature>
+    class View {
+        using Parameters =
+            typename Internal::SignatureParameters<Signature,
+                                                   ComponentsList>::type;
+        using ValueHelper =
+            EC::Meta::Morph<Parameters, ViewValueHelper<> >;
+
+       public:
+        using value_type = typename ValueHelper::type;
+
+        class iterator {
+           public:
+            // dereferencing gives a tuple of references by value, so this
+            // is only an input iterator
+            using iterator_category = std::input_iterator_tag;
+            using value_type = typename View::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = value_type;
+
+            iterator() : view(nullptr), entityID(0), rest(0) {}
+
+            reference operator*() const {
+                return ValueHelper::get(*view->manager, entityID);
+            }
+
+            iterator& operator++() {
+                const MatchScan& scan = view->scan;
+                // the other matches of the current word found earlier
+                while (rest != 0) {
+                    const std::size_t id = entityID - entityID % 64 +
+                                           Internal::countTrailingZeros(rest);
+                    rest &= rest - 1;
+                    if (id >= view->rangeEnd) {
+                        break;
+                    } else if (view->manager->stillMatches(scan, id)) {
+                        entityID = id;
+                        return *this;
+                    }
+                }
+                const std::size_t next = entityID - entityID % 64 + 64;
+                entityID = next < view->rangeEnd
+                               ? view->manager->findMatching(
+                                     scan, next, view->rangeEnd, rest)
+                               : view->rangeEnd;
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+
+            bool operator==(const iterator& other) const {
+                return entityID == other.entityID;
+            }
+
+            bool operator!=(const iterator& other) const {
+                return entityID != other.entityID;
+            }
+
+           private:
+            friend class View;
+
+            iterator(const View* view, std::size_t entityID,
+                     std::uint64_t rest)
+                : view(view), entityID(entityID), rest(rest) {}
+
+            const View* view;
+            std::size_t entityID;
+            // matches in the word of entityID after entityID, as bits
+            std::uint64_t rest;
+        };
+
+        iterator begin() const {
+            std::uint64_t rest = 0;
+            const std::size_t first =
+                manager->findMatching(scan, rangeBegin, rangeEnd, rest);
+            return iterator(this, first, rest);
+        }
+
+        iterator end() const { return iterator(this, rangeEnd, 0); }
+
+        /// Returns the range [begin, end) of entity IDs covered by the View.
+        std::array<std::size_t, 2> getRange() const {
+            return {rangeBegin, rangeEnd};
+        }
+
+        /*!
+            \brief Splits the View into at most "count" Views covering
+                consecutive parts of its range of entity IDs.
+        */
+        std::vector<View> split(std::size_t count) const {
+            std::vector<View> views;
+            const std::size_t size = rangeEnd - rangeBegin;
+            if (count > size) {
+                count = size;
+            }
+            for (std::size_t i = 0; i < count; ++i) {
+                views.push_back(View(manager, scan,
+                                     rangeBegin + size * i / count,
+                                     rangeBegin + size * (i + 1) / count));
+            }
+            return views;
+        }
+
+       private:
+        friend struct Manager;
+
+        View(Manager* manager, const MatchScan& scan, std::size_t rangeBegin,
+             std::size_t rangeEnd)
+            : manager(manager),
+              scan(scan),
+              rangeBegin(rangeBegin),
+              rangeEnd(rangeEnd) {}
+
+        Manager* manager;
+        // iterators point to the View, and through it to this scan
+        MatchScan scan;
+        std::size_t rangeBegin;
+        std::size_t rangeEnd;
+    };
+
+    /*!
+        \brief Returns a View over the entities matching the given
+            Signature.
+
+        Unlike the "forMatching" functions, a View is iterated with a
+        range-based for loop, so the loop body is not called through a
+        function pointer or std::function and may be inlined.
+
+        The iterators of a View refer to the View (which holds the scan of
+        the Signature), so the View must outlive its iterators. They are
+        input iterators, since dereferencing one gives a std::tuple of the
+        entity ID and the Components by value. Calling reset() invalidates
+        the View and its iterators.
+
+        Deletions are not deferred while iterating a View. Deleting the
+        entity the iterator is on is allowed, but the Components of other
+        entities must not be accessed after deleting them.
+
+        Example:
+        \code{.cpp}
+            for (auto entity : manager.view<TypeList<C0, C1, T0>>()) {
+                std::size_t id = std::get<0>(entity);
+                C0& c0 = std::get<1>(entity);
+                C1& c1 = std::get<2>(entity);
+            }
+
+            // in parallel
+            auto views = manager.view<TypeList<C0>>().split(4);
+        \endcode
+    */
+    template <typename Signature>
+    View<Signature> view() {
+        startChangeTick();
+        return View<Signature>(
+            this, getMatchScan(generateSignatureBitsets<Signature>()), 0,
+            currentSize);
+    }
+
+    /*!
+        \brief Returns the number of entities matching the given Signature.
+
+        No function is called and no Component is accessed, so this is
+        cheaper than counting with one of the "forMatching" functions. The
+        matching entities are counted 64 at a time from the bitplanes, or
+        from the archetype index if it is enabled (see
+        setArchetypeIndexEnabled()) and the Signature has no EC::Changed or
+        EC::Added filter.
+
+        If the parameter is true, then sections of entities are counted in
+        parallel with the ThreadPool.
+    */
+    template <typename Signature>
+    std::size_t countMatching(const bool useThreadPool = false) const {
+        const SignatureBitsets signature =
+            generateSignatureBitsets<Signature>();
+        if (archetypeIndexEnabled && !signature.hasChangeFilters()) {
+            std::shared_lock<std::shared_timed_mutex> lock(archetypeMutex);
+            std::size_t count = 0;
+            for (const auto& archetype : archetypes) {
+                if (signature.matches(archetype->bitset)) {
+                    std::lock_guard<std::mutex> archetypeLock(
+                        archetype->mutex);
+                    count += archetype->entities.size();
+                }
+            }
+            return count;
+        }
+
+        const MatchScan scan = getMatchScan(signature);
+        if (!usesThreadPool(useThreadPool)) {
+            return countMatches(scan, 0, currentSize);
+        }
+
+        ScratchLease scratch(*this);
+        const std::vector<ChunkRange>& ranges =
+            scratch.getChunkRanges(currentSize);
+        TPFnDataStructFour* fnDataAr =
+            scratch.template getTaskData<TPFnDataStructFour>(ranges.size());
+        TPBatch batch;
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            fnDataAr[i].range = ranges[i];
+            fnDataAr[i].manager = this;
+            fnDataAr[i].scan = &scan;
+            fnDataAr[i].count = 0;
+            threadPool->queueFn(
+                [](void* ud) {
+                    auto* data = static_cast<TPFnDataStructFour*>(ud);
+                    data->count = data->manager->countMatches(
+                        *data->scan, data->range[0], data->range[1]);
+                },
+                &fnDataAr[i], batch);
+        }
+        threadPool->easyStartAndWait(batch);
+
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            const TPFnDataStructFour& data = fnDataAr[i];
+            count += data.count;
+        }
+        return count;
+    }
+
+    /*!
+        \brief Returns whether any entity matches the given Signature.
+
+        Like countMatching(), but stops at the first matching entity.
+
+        If the parameter is true, then sections of entities are searched in
+        parallel with the ThreadPool, and all sections stop once any of them
+        found a matching entity.
+    */
+    template <typename Signature>
+    bool anyMatching(const bool useThreadPool = false) const {
+        const SignatureBitsets signature =
+            generateSignatureBitsets<Signature>();
+        if (archetypeIndexEnabled && !signature.hasChangeFilters()) {
+            std::shared_lock<std::shared_timed_mutex> lock(archetypeMutex);
+            for (const auto& archetype : archetypes) {
+                if (signature.matches(archetype->bitset)) {
+                    std::lock_guard<std::mutex> archetypeLock(
+                        archetype->mutex);
+                    if (!archetype->entities.empty()) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        const MatchScan scan = getMatchScan(signature);
+        if (usesThreadPool(useThreadPool)) {
+            return findMatchingParallel(scan, true) < currentSize;
+        }
+        std::uint64_t rest;
+        return findMatching(scan, 0, currentSize, rest) < currentSize;
+    }
+
+    /*!
+        \brief Finds the entity with the lowest ID matching the given
+            Signature.
+
+        Like countMatching(), but stops at the first matching entity.
+
+        If the parameter is true, then sections of entities are searched in
+        parallel with the ThreadPool. A section stops once a matching entity
+        with a lower ID than the rest of its entities was found.
+
+        \return False if no entity matches, otherwise true with the ID of
+            the entity set to the given reference.
+    */
+    template <typename Signature>
+    bool firstMatching(std::size_t& id,
+                       const bool useThreadPool = false) const {
+        const MatchScan scan =
+            getMatchScan(generateSignatureBitsets<Signature>());
+        std::size_t found;
+        if (usesThreadPool(useThreadPool)) {
+            found = findMatchingParallel(scan, false);
+        } else {
+            std::uint64_t rest;
+            found = findMatching(scan, 0, currentSize, rest);
+        }
+        if (found < currentSize) {
+            id = found;
+            return true;
+        }
+        return false;
+    }
 
-                if ((signatureBitset & std::get<BitsetType>(entities[i])) ==
-                    signatureBitset) {
-                    Helper::callPtr(i, *this, function, userData);
-                }
+   private:
+    // entities matching the signature of a stored function, kept up to date
+    // as entities change so that calling the function does not need to
+    // check every entity
+    struct MatchingCache {
+        std::vector<std::size_t> ids;
+        // position of each entity in ids, or ~0 if the entity is not in ids
+        std::vector<std::size_t> positions;
+        bool sorted = true;
+
+        void insert(std::size_t id, std::size_t capacity) {
+            if (positions.size() < capacity) {
+                positions.resize(capacity, ~std::size_t(0));
             }
-        } else {
-            std::array<TPFnDataStructOne<Function>, ThreadCount * 2> fnDataAr;
-
-            std::size_t s = currentSize / (ThreadCount * 2);
-            for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                std::size_t begin = s * i;
-                std::size_t end;
-                if (i == ThreadCount * 2 - 1) {
-                    end = currentSize;
-                } else {
-                    end = s * (i + 1);
-                }
-                if (begin == end) {
-                    continue;
-                }
-                fnDataAr[i].range = {begin, end};
-                fnDataAr[i].manager = this;
-                fnDataAr[i].entities = &entities;
-                fnDataAr[i].signature = &signatureBitset;
-                fnDataAr[i].userData = userData;
-                fnDataAr[i].fn = function;
-                for (std::size_t j = begin; j < end; ++j) {
-                    if (!isAlive(j)) {
-                        fnDataAr[i].dead.insert(j);
-                    }
-                }
-                threadPool->queueFn(
-                    [](void* ud) {
-                        auto* data =
-                            static_cast<TPFnDataStructOne<Function>*>(ud);
-                        for (std::size_t i = data->range[0]; i < data->range[1];
-                             ++i) {
-                            if (data->dead.find(i) != data->dead.end()) {
-                                continue;
-                            }
+            positions[id] = ids.size();
+            if (!ids.empty() && ids.back() > id) {
+                sorted = false;
+            }
+            ids.push_back(id);
+        }
 
-                            if (((*data->signature) &
-                                 std::get<BitsetType>(data->entities->at(i))) ==
-                                *data->signature) {
-                                Helper::callPtr(i, *data->manager, data->fn,
-                                                data->userData);
-                            }
-                        }
-                    },
-                    &fnDataAr[i]);
+        void erase(std::size_t id) {
+            const std::size_t position = positions[id];
+            if (position != ids.size() - 1) {
+                ids[position] = ids.back();
+                positions[ids[position]] = position;
+                sorted = false;
             }
-            threadPool->easyStartAndWait();
+            ids.pop_back();
+            positions[id] = ~std::size_t(0);
         }
 
-        // pop from idStack "call stack"
-        do {
-            {
-                std::lock_guard<std::mutex> lock(idStackMutex);
-                if (idStack.back() == current_id) {
-                    idStack.pop_back();
-                    break;
+        // returns ids in order of entity ID
+        const std::vector<std::size_t>& getSorted() {
+            if (!sorted) {
+                std::sort(ids.begin(), ids.end());
+                for (std::size_t i = 0; i < ids.size(); ++i) {
+                    positions[ids[i]] = i;
                 }
+                sorted = true;
             }
-            std::this_thread::sleep_for(std::chrono::microseconds(15));
-        } while (true);
-
-        handleDeferredDeletions();
-    }
+            return ids;
+        }
+    };
 
-   private:
     std::map<std::size_t,
-             std::tuple<BitsetType, void*,
+             std::tuple<SignatureBitsets, void*,
                         std::function<void(std::size_t,
-                                           std::vector<std::size_t>, void*)> > >
+                                           std::vector<std::size_t>, void*)>,
+                        MatchingCache> >
         forMatchingFunctions;
     std::size_t functionIndex = 0;
+    // guards the MatchingCache of every stored function
+    std::mutex matchingCachesMutex;
+
+    // returns a copy of the cached matching entities in order of ID
+    std::vector<std::size_t> getCachedMatching(MatchingCache& cache) {
+        std::lock_guard<std::mutex> lock(matchingCachesMutex);
+        return cache.getSorted();
+    }
 
    public:
     /*!
@@ -931,6 +3465,12 @@ struct Manager {
         Note that the context pointer provided here (default nullptr) will
         be provided to the stored function when called.
 
+        The Manager keeps track of the entities matching each stored
+        function's signature as entities change, so calling a stored function
+        does not need to check every entity. The cost of this tracking is
+        paid on every change to an entity's Components or Tags and grows with
+        the number of stored functions.
+
         Example:
         \code{.cpp}
             manager.addForMatchingFunction<TypeList<C0, C1, T0>>([]
@@ -963,13 +3503,21 @@ struct Manager {
         }
 
         using SignatureComponents =
-            typename EC::Meta::Matching<Signature, ComponentsList>::type;
+            typename Internal::SignatureParameters<Signature,
+                                                   ComponentsList>::type;
         using Helper =
             EC::Meta::Morph<SignatureComponents, ForMatchingSignatureHelper<> >;
 
         Helper helper;
-        BitsetType signatureBitset =
-            BitsetType::template generateBitset<Signature>();
+        SignatureBitsets signatureBitset =
+            generateSignatureBitsets<Signature>();
+
+        MatchingCache cache;
+        const std::vector<std::vector<std::size_t> > matching =
+            getMatchingEntities({&signatureBitset});
+        for (std::size_t id : matching[0]) {
+            cache.insert(id, currentCapacity);
+        }
 
         forMatchingFunctions.emplace(std::make_pair(
             functionIndex,
@@ -978,7 +3526,7 @@ struct Manager {
                 [function, helper, this](const bool useThreadPool,
                                          std::vector<std::size_t> matching,
                                          void* userData) {
-                    if (!useThreadPool || !threadPool) {
+                    if (!usesThreadPool(useThreadPool)) {
                         for (auto eid : matching) {
                             if (isAlive(eid)) {
                                 helper.callInstancePtr(eid, *this, &function,
@@ -986,122 +3534,109 @@ struct Manager {
                             }
                         }
                     } else {
-                        std::array<TPFnDataStructTwo, ThreadCount * 2> fnDataAr;
-
-                        std::size_t s = matching.size() / (ThreadCount * 2);
-                        for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                            std::size_t begin = s * i;
-                            std::size_t end;
-                            if (i == ThreadCount * 2 - 1) {
-                                end = matching.size();
-                            } else {
-                                end = s * (i + 1);
-                            }
-                            if (begin == end) {
-                                continue;
-                            }
-                            fnDataAr[i].range = {begin, end};
+                        ScratchLease scratch(*this);
+                        const std::vector<ChunkRange>& ranges =
+                            scratch.getChunkRanges(matching.size());
+                        const AliveBitmapType& aliveSnapshot =
+                            scratch.getAliveSnapshot();
+                        TPFnDataStructTwo* fnDataAr =
+                            scratch.template getTaskData<TPFnDataStructTwo>(
+                                ranges.size());
+                        TPBatch batch;
+
+                        for (std::size_t i = 0; i < ranges.size(); ++i) {
+                            fnDataAr[i].range = ranges[i];
                             fnDataAr[i].manager = this;
                             fnDataAr[i].entities = &entities;
                             fnDataAr[i].userData = userData;
                             fnDataAr[i].matching = &matching;
-                            for (std::size_t j = begin; j < end; ++j) {
-                                if (!isAlive(matching.at(j))) {
-                                    fnDataAr[i].dead.insert(j);
-                                }
-                            }
+                            fnDataAr[i].alive = &aliveSnapshot;
                             threadPool->queueFn(
                                 [&function, helper](void* ud) {
                                     auto* data =
                                         static_cast<TPFnDataStructTwo*>(ud);
                                     for (std::size_t i = data->range[0];
                                          i < data->range[1]; ++i) {
-                                        if (data->dead.find(i) ==
-                                            data->dead.end()) {
+                                        const std::size_t id =
+                                            (*data->matching)[i];
+                                        if (isAliveIn(*data->alive, id)) {
                                             helper.callInstancePtr(
-                                                data->matching->at(i),
-                                                *data->manager, &function,
+                                                id, *data->manager, &function,
                                                 data->userData);
                                         }
                                     }
                                 },
-                                &fnDataAr[i]);
+                                &fnDataAr[i], batch);
                         }
-                        threadPool->easyStartAndWait();
+                        threadPool->easyStartAndWait(batch);
                     }
-                })));
+                },
+                std::move(cache))));
 
         handleDeferredDeletions();
         return functionIndex++;
     }
 
    private:
+    // returns the alive entities matching each of the given signatures, in
+    // order of ID
     std::vector<std::vector<std::size_t> > getMatchingEntities(
-        std::vector<BitsetType*> bitsets, const bool useThreadPool = false) {
+        std::vector<const SignatureBitsets*> bitsets,
+        const bool useThreadPool = false) {
         std::vector<std::vector<std::size_t> > matchingV(bitsets.size());
 
-        if (!useThreadPool || !threadPool) {
-            for (std::size_t i = 0; i < currentSize; ++i) {
-                if (!isAlive(i)) {
-                    continue;
-                }
-                for (std::size_t j = 0; j < bitsets.size(); ++j) {
-                    if (((*bitsets[j]) & std::get<BitsetType>(entities[i])) ==
-                        (*bitsets[j])) {
-                        matchingV[j].push_back(i);
-                    }
-                }
+        if (archetypeIndexEnabled) {
+            for (std::size_t j = 0; j < bitsets.size(); ++j) {
+                matchingV[j] = getArchetypeMatching(*bitsets[j]);
+                removeUnchanged(*bitsets[j], matchingV[j]);
             }
+        } else if (!usesThreadPool(useThreadPool)) {
+            scanPlanned(getMatchPlan(bitsets), 0, currentSize, nullptr,
+                        matchingV);
         } else {
-            std::array<TPFnDataStructThree, ThreadCount * 2> fnDataAr;
-
-            std::size_t s = currentSize / (ThreadCount * 2);
-            std::mutex mutex;
-            for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                std::size_t begin = s * i;
-                std::size_t end;
-                if (i == ThreadCount * 2 - 1) {
-                    end = currentSize;
-                } else {
-                    end = s * (i + 1);
-                }
-                if (begin == end) {
-                    continue;
-                }
-                fnDataAr[i].range = {begin, end};
+            ScratchLease scratch(*this);
+            const std::vector<ChunkRange>& ranges =
+                scratch.getChunkRanges(currentSize);
+            const AliveBitmapType& aliveSnapshot = scratch.getAliveSnapshot();
+            const MatchPlan plan = getMatchPlan(bitsets);
+            TPFnDataStructThree* fnDataAr =
+                scratch.template getTaskData<TPFnDataStructThree>(
+                    ranges.size());
+            TPBatch batch;
+
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                fnDataAr[i].range = ranges[i];
                 fnDataAr[i].manager = this;
-                fnDataAr[i].matchingV = &matchingV;
-                fnDataAr[i].bitsets = &bitsets;
-                fnDataAr[i].entities = &entities;
-                fnDataAr[i].mutex = &mutex;
-                for (std::size_t j = begin; j < end; ++j) {
-                    if (!isAlive(j)) {
-                        fnDataAr[i].dead.insert(j);
-                    }
-                }
+                fnDataAr[i].matchingV.resize(bitsets.size());
+                fnDataAr[i].plan = &plan;
+                fnDataAr[i].alive = &aliveSnapshot;
                 threadPool->queueFn(
                     [](void* ud) {
                         auto* data = static_cast<TPFnDataStructThree*>(ud);
-                        for (std::size_t i = data->range[0]; i < data->range[1];
-                             ++i) {
-                            if (data->dead.find(i) != data->dead.end()) {
-                                continue;
-                            }
-                            for (std::size_t j = 0; j < data->bitsets->size();
-                                 ++j) {
-                                if ((*data->bitsets->at(j) &
-                                     std::get<BitsetType>(data->entities->at(
-                                         i))) == *data->bitsets->at(j)) {
-                                    std::lock_guard<std::mutex> lock(
-                                        *data->mutex);
-                                    data->matchingV->at(j).push_back(i);
-                                }
-                            }
-                        }
+                        data->manager->scanPlanned(
+                            *data->plan, data->range[0], data->range[1],
+                            data->alive, data->matchingV);
                     },
-                    &fnDataAr[i]);
+                    &fnDataAr[i], batch);
+            }
+            threadPool->easyStartAndWait(batch);
+
+            // the ranges are in order, so concatenating their results keeps
+            // the matching entities in order of ID
+            for (std::size_t j = 0; j < bitsets.size(); ++j) {
+                std::size_t total = 0;
+                for (std::size_t i = 0; i < ranges.size(); ++i) {
+                    const TPFnDataStructThree& data = fnDataAr[i];
+                    total += data.matchingV[j].size();
+                }
+                matchingV[j].reserve(total);
+                for (std::size_t i = 0; i < ranges.size(); ++i) {
+                    const TPFnDataStructThree& data = fnDataAr[i];
+                    matchingV[j].insert(matchingV[j].end(),
+                                        data.matchingV[j].begin(),
+                                        data.matchingV[j].end());
+                }
             }
-            threadPool->easyStartAndWait();
         }
 
         return matchingV;
@@ -1141,15 +3676,18 @@ struct Manager {
     */
     void callForMatchingFunctions(const bool useThreadPool = false) {
         deferringDeletions.fetch_add(1);
-        std::vector<BitsetType*> bitsets;
+        startChangeTick();
+        // copied so that changes made by the called functions do not affect
+        // which entities the stored functions are called on
+        std::vector<std::vector<std::size_t> > matching;
         for (auto iter = forMatchingFunctions.begin();
              iter != forMatchingFunctions.end(); ++iter) {
-            bitsets.push_back(&std::get<BitsetType>(iter->second));
+            matching.push_back(
+                getCachedMatching(std::get<MatchingCache>(iter->second)));
+            removeUnchanged(std::get<SignatureBitsets>(iter->second),
+                            matching.back());
         }
 
-        std::vector<std::vector<std::size_t> > matching =
-            getMatchingEntities(bitsets, useThreadPool);
-
         std::size_t i = 0;
         for (auto iter = forMatchingFunctions.begin();
              iter != forMatchingFunctions.end(); ++iter) {
@@ -1196,10 +3734,11 @@ struct Manager {
             return false;
         }
         deferringDeletions.fetch_add(1);
-        std::vector<std::vector<std::size_t> > matching = getMatchingEntities(
-            std::vector<BitsetType*>{&std::get<BitsetType>(iter->second)},
-            useThreadPool);
-        std::get<2>(iter->second)(useThreadPool, matching[0],
+        startChangeTick();
+        std::vector<std::size_t> matching =
+            getCachedMatching(std::get<MatchingCache>(iter->second));
+        removeUnchanged(std::get<SignatureBitsets>(iter->second), matching);
+        std::get<2>(iter->second)(useThreadPool, std::move(matching),
                                   std::get<1>(iter->second));
 
         handleDeferredDeletions();
@@ -1366,180 +3905,105 @@ struct Manager {
         This function instead iterates through all entities once,
         storing matching entities in a vector of vectors (for each
         signature and function pair) and then calling functions with
-        the matching list of entities.
+        the matching list of entities. A signature that contains all the
+        Components, Tags and EC::Without filters of another signature is only
+        tested on the entities matching that other signature, so signatures
+        that overlap cost little more than one of them.
 
         Note that multi-threaded or not, functions will be called in order
         of signatures. The first function signature pair will be called
         first, then the second, third, and so on.
-        If this function is called with more than 1 thread specified, then
-        the order of entities called is not guaranteed. Otherwise entities
-        will be called in consecutive order by their ID.
+        Without the ThreadPool, entities will be called in consecutive order
+        by their ID. With the ThreadPool, the matching entities of a
+        signature are gathered in order of ID (the same list on every call
+        for the same entities) and split into sections of consecutive
+        entities. Each section calls the function on its entities in order of
+        ID, while the sections run concurrently.
     */
     template <typename SigList, typename FTuple>
     void forMatchingSignatures(FTuple fTuple, void* userData = nullptr,
                                const bool useThreadPool = false) {
-        std::size_t current_id;
-        {
-            // push to idStack "call stack"
-            std::lock_guard<std::mutex> lock(idStackMutex);
-            current_id = idStackCounter++;
-            idStack.push_back(current_id);
-        }
+        const std::size_t current_id = pushIdStack();
         deferringDeletions.fetch_add(1);
         std::vector<std::vector<std::size_t> > multiMatchingEntities(
             SigList::size);
-        BitsetType signatureBitsets[SigList::size];
+        SignatureBitsets signatureBitsets[SigList::size];
 
         // generate bitsets for each signature
         EC::Meta::forEachWithIndex<SigList>(
             [&signatureBitsets](auto signature, const auto index) {
                 signatureBitsets[index] =
-                    BitsetType::template generateBitset<decltype(signature)>();
+                    generateSignatureBitsets<decltype(signature)>();
             });
 
-        // find and store entities matching signatures
-        if (!useThreadPool || !threadPool) {
-            for (std::size_t eid = 0; eid < currentSize; ++eid) {
-                if (!isAlive(eid)) {
-                    continue;
-                }
-                for (std::size_t i = 0; i < SigList::size; ++i) {
-                    if ((signatureBitsets[i] &
-                         std::get<BitsetType>(entities[eid])) ==
-                        signatureBitsets[i]) {
-                        multiMatchingEntities[i].push_back(eid);
-                    }
-                }
-            }
-        } else {
-            std::array<TPFnDataStructFour, ThreadCount * 2> fnDataAr;
-
-            std::mutex mutex;
-            std::size_t s = currentSize / (ThreadCount * 2);
-            for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                std::size_t begin = s * i;
-                std::size_t end;
-                if (i == ThreadCount * 2 - 1) {
-                    end = currentSize;
-                } else {
-                    end = s * (i + 1);
-                }
-                if (begin == end) {
-                    continue;
-                }
-                fnDataAr[i].range = {begin, end};
-                fnDataAr[i].manager = this;
-                fnDataAr[i].multiMatchingEntities = &multiMatchingEntities;
-                fnDataAr[i].signatures = signatureBitsets;
-                fnDataAr[i].mutex = &mutex;
-                for (std::size_t j = begin; j < end; ++j) {
-                    if (!isAlive(j)) {
-                        fnDataAr[i].dead.insert(j);
-                    }
-                }
+        // entities that are added while the functions run are skipped
+        ScratchLease aliveScratch(*this);
+        const AliveBitmapType& aliveSnapshot =
+            aliveScratch.getAliveSnapshot(usesThreadPool(useThreadPool));
 
-                threadPool->queueFn(
-                    [](void* ud) {
-                        auto* data = static_cast<TPFnDataStructFour*>(ud);
-                        for (std::size_t i = data->range[0]; i < data->range[1];
-                             ++i) {
-                            if (data->dead.find(i) != data->dead.end()) {
-                                continue;
-                            }
-                            for (std::size_t j = 0; j < SigList::size; ++j) {
-                                if ((data->signatures[j] &
-                                     std::get<BitsetType>(
-                                         data->manager->entities[i])) ==
-                                    data->signatures[j]) {
-                                    std::lock_guard<std::mutex> lock(
-                                        *data->mutex);
-                                    data->multiMatchingEntities->at(j)
-                                        .push_back(i);
-                                }
-                            }
-                        }
-                    },
-                    &fnDataAr[i]);
-            }
-            threadPool->easyStartAndWait();
+        // find and store entities matching signatures
+        std::vector<const SignatureBitsets*> signaturePtrs;
+        for (std::size_t i = 0; i < SigList::size; ++i) {
+            signaturePtrs.push_back(&signatureBitsets[i]);
         }
+        multiMatchingEntities =
+            getMatchingEntities(signaturePtrs, useThreadPool);
 
         // call functions on matching entities
         EC::Meta::forEachDoubleTuple(
             EC::Meta::Morph<SigList, std::tuple<> >{}, fTuple,
-            [this, &multiMatchingEntities, useThreadPool, &userData](
-                auto sig, auto func, auto index) {
+            [this, &multiMatchingEntities, &aliveSnapshot, useThreadPool,
+             &userData](auto sig, auto func, auto index) {
                 using SignatureComponents =
-                    typename EC::Meta::Matching<decltype(sig),
-                                                ComponentsList>::type;
+                    typename Internal::SignatureParameters<
+                        decltype(sig), ComponentsList>::type;
                 using Helper = EC::Meta::Morph<SignatureComponents,
                                                ForMatchingSignatureHelper<> >;
-                if (!useThreadPool || !threadPool) {
+                if (!usesThreadPool(useThreadPool)) {
                     for (const auto& id : multiMatchingEntities[index]) {
                         if (isAlive(id)) {
                             Helper::call(id, *this, func, userData);
                         }
                     }
                 } else {
-                    std::array<TPFnDataStructFive, ThreadCount * 2> fnDataAr;
-                    std::size_t s =
-                        multiMatchingEntities[index].size() / (ThreadCount * 2);
-                    for (unsigned int i = 0; i < ThreadCount * 2; ++i) {
-                        std::size_t begin = s * i;
-                        std::size_t end;
-                        if (i == ThreadCount * 2 - 1) {
-                            end = multiMatchingEntities[index].size();
-                        } else {
-                            end = s * (i + 1);
-                        }
-                        if (begin == end) {
-                            continue;
-                        }
-                        fnDataAr[i].range = {begin, end};
+                    ScratchLease scratch(*this);
+                    const std::vector<ChunkRange>& ranges =
+                        scratch.getChunkRanges(
+                            multiMatchingEntities[index].size());
+                    TPFnDataStructFive* fnDataAr =
+                        scratch.template getTaskData<TPFnDataStructFive>(
+                            ranges.size());
+                    TPBatch batch;
+                    for (std::size_t i = 0; i < ranges.size(); ++i) {
+                        fnDataAr[i].range = ranges[i];
                         fnDataAr[i].index = index;
                         fnDataAr[i].manager = this;
                         fnDataAr[i].userData = userData;
                         fnDataAr[i].multiMatchingEntities =
                             &multiMatchingEntities;
-                        for (std::size_t j = begin; j < end; ++j) {
-                            if (!isAlive(
-                                    multiMatchingEntities.at(index).at(j))) {
-                                fnDataAr[i].dead.insert(j);
-                            }
-                        }
+                        fnDataAr[i].alive = &aliveSnapshot;
                         threadPool->queueFn(
                             [&func](void* ud) {
                                 auto* data =
                                     static_cast<TPFnDataStructFive*>(ud);
                                 for (std::size_t i = data->range[0];
                                      i < data->range[1]; ++i) {
-                                    if (data->dead.find(i) ==
-                                        data->dead.end()) {
-                                        Helper::call(data->multiMatchingEntities
-                                                         ->at(data->index)
-                                                         .at(i),
-                                                     *data->manager, func,
+                                    const std::size_t id =
+                                        (*data->multiMatchingEntities)
+                                            [data->index][i];
+                                    if (isAliveIn(*data->alive, id)) {
+                                        Helper::call(id, *data->manager, func,
                                                      data->userData);
                                     }
                                 }
                             },
-                            &fnDataAr[i]);
+                            &fnDataAr[i], batch);
                     }
-                    threadPool->easyStartAndWait();
+                    threadPool->easyStartAndWait(batch);
                 }
             });
 
-        // pop from idStack "call stack"
-        do {
-            {
-                std::lock_guard<std::mutex> lock(idStackMutex);
-                if (idStack.back() == current_id) {
-                    idStack.pop_back();
-                    break;
-                }
-            }
-            std::this_thread::sleep_for(std::chrono::microseconds(15));
-        } while (true);
+        popIdStack(current_id);
 
         handleDeferredDeletions();
     }
@@ -1586,188 +4050,322 @@ struct Manager {
         This function instead iterates through all entities once,
         storing matching entities in a vector of vectors (for each
         signature and function pair) and then calling functions with
-        the matching list of entities.
+        the matching list of entities. A signature that contains all the
+        Components, Tags and EC::Without filters of another signature is only
+        tested on the entities matching that other signature, so signatures
+        that overlap cost little more than one of them.
 
         Note that multi-threaded or not, functions will be called in order
         of signatures. The first function signature pair will be called
         first, then the second, third, and so on.
-        If this function is called with more than 1 thread specified, then
-        the order of entities called is not guaranteed. Otherwise entities
-        will be called in consecutive order by their ID.
+        Without the ThreadPool, entities will be called in consecutive order
+        by their ID. With the ThreadPool, the matching entities of a
+        signature are gathered in order of ID (the same list on every call
+        for the same entities) and split into sections of consecutive
+        entities. Each section calls the function on its entities in order of
+        ID, while the sections run concurrently.
     */
     template <typename SigList, typename FTuple>
     void forMatchingSignaturesPtr(FTuple fTuple, void* userData = nullptr,
                                   const bool useThreadPool = false) {
-        std::size_t current_id;
-        {
-            // push to idStack "call stack"
-            std::lock_guard<std::mutex> lock(idStackMutex);
-            current_id = idStackCounter++;
-            idStack.push_back(current_id);
-        }
+        const std::size_t current_id = pushIdStack();
         deferringDeletions.fetch_add(1);
         std::vector<std::vector<std::size_t> > multiMatchingEntities(
             SigList::size);
-        BitsetType signatureBitsets[SigList::size];
+        SignatureBitsets signatureBitsets[SigList::size];
 
         // generate bitsets for each signature
         EC::Meta::forEachWithIndex<SigList>(
             [&signatureBitsets](auto signature, const auto index) {
                 signatureBitsets[index] =
-                    BitsetType::template generateBitset<decltype(signature)>();
+                    generateSignatureBitsets<decltype(signature)>();
             });
 
-        // find and store entities matching signatures
-        if (!useThreadPool || !threadPool) {
-            for (std::size_t eid = 0; eid < currentSize; ++eid) {
-                if (!isAlive(eid)) {
-                    continue;
-                }
-                for (std::size_t i = 0; i < SigList::size; ++i) {
-                    if ((signatureBitsets[i] &
-                         std::get<BitsetType>(entities[eid])) ==
-                        signatureBitsets[i]) {
-                        multiMatchingEntities[i].push_back(eid);
-                    }
-                }
-            }
-        } else {
-            std::array<TPFnDataStructSix, ThreadCount * 2> fnDataAr;
-
-            std::mutex mutex;
-            std::size_t s = currentSize / (ThreadCount * 2);
-            for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                std::size_t begin = s * i;
-                std::size_t end;
-                if (i == ThreadCount * 2 - 1) {
-                    end = currentSize;
-                } else {
-                    end = s * (i + 1);
-                }
-                if (begin == end) {
-                    continue;
-                }
-                fnDataAr[i].range = {begin, end};
-                fnDataAr[i].manager = this;
-                fnDataAr[i].multiMatchingEntities = &multiMatchingEntities;
-                fnDataAr[i].bitsets = signatureBitsets;
-                fnDataAr[i].mutex = &mutex;
-                for (std::size_t j = begin; j < end; ++j) {
-                    if (!isAlive(j)) {
-                        fnDataAr[i].dead.insert(j);
-                    }
-                }
+        // entities that are added while the functions run are skipped
+        ScratchLease aliveScratch(*this);
+        const AliveBitmapType& aliveSnapshot =
+            aliveScratch.getAliveSnapshot(usesThreadPool(useThreadPool));
 
-                threadPool->queueFn(
-                    [](void* ud) {
-                        auto* data = static_cast<TPFnDataStructSix*>(ud);
-                        for (std::size_t i = data->range[0]; i < data->range[1];
-                             ++i) {
-                            if (data->dead.find(i) != data->dead.end()) {
-                                continue;
-                            }
-                            for (std::size_t j = 0; j < SigList::size; ++j) {
-                                if ((data->bitsets[j] &
-                                     std::get<BitsetType>(
-                                         data->manager->entities[i])) ==
-                                    data->bitsets[j]) {
-                                    std::lock_guard<std::mutex> lock(
-                                        *data->mutex);
-                                    data->multiMatchingEntities->at(j)
-                                        .push_back(i);
-                                }
-                            }
-                        }
-                    },
-                    &fnDataAr[i]);
-            }
-            threadPool->easyStartAndWait();
+        // find and store entities matching signatures
+        std::vector<const SignatureBitsets*> signaturePtrs;
+        for (std::size_t i = 0; i < SigList::size; ++i) {
+            signaturePtrs.push_back(&signatureBitsets[i]);
         }
+        multiMatchingEntities =
+            getMatchingEntities(signaturePtrs, useThreadPool);
 
         // call functions on matching entities
         EC::Meta::forEachDoubleTuple(
             EC::Meta::Morph<SigList, std::tuple<> >{}, fTuple,
-            [this, &multiMatchingEntities, useThreadPool, &userData](
-                auto sig, auto func, auto index) {
+            [this, &multiMatchingEntities, &aliveSnapshot, useThreadPool,
+             &userData](auto sig, auto func, auto index) {
                 using SignatureComponents =
-                    typename EC::Meta::Matching<decltype(sig),
-                                                ComponentsList>::type;
+                    typename Internal::SignatureParameters<
+                        decltype(sig), ComponentsList>::type;
                 using Helper = EC::Meta::Morph<SignatureComponents,
                                                ForMatchingSignatureHelper<> >;
-                if (!useThreadPool || !threadPool) {
+                if (!usesThreadPool(useThreadPool)) {
                     for (const auto& id : multiMatchingEntities[index]) {
                         if (isAlive(id)) {
                             Helper::callPtr(id, *this, func, userData);
                         }
                     }
                 } else {
-                    std::array<TPFnDataStructFive, ThreadCount * 2> fnDataAr;
-                    std::size_t s =
-                        multiMatchingEntities[index].size() / (ThreadCount * 2);
-                    for (unsigned int i = 0; i < ThreadCount * 2; ++i) {
-                        std::size_t begin = s * i;
-                        std::size_t end;
-                        if (i == ThreadCount * 2 - 1) {
-                            end = multiMatchingEntities[index].size();
-                        } else {
-                            end = s * (i + 1);
-                        }
-                        if (begin == end) {
-                            continue;
-                        }
-                        fnDataAr[i].range = {begin, end};
+                    ScratchLease scratch(*this);
+                    const std::vector<ChunkRange>& ranges =
+                        scratch.getChunkRanges(
+                            multiMatchingEntities[index].size());
+                    TPFnDataStructFive* fnDataAr =
+                        scratch.template getTaskData<TPFnDataStructFive>(
+                            ranges.size());
+                    TPBatch batch;
+                    for (std::size_t i = 0; i < ranges.size(); ++i) {
+                        fnDataAr[i].range = ranges[i];
                         fnDataAr[i].index = index;
                         fnDataAr[i].manager = this;
                         fnDataAr[i].userData = userData;
                         fnDataAr[i].multiMatchingEntities =
                             &multiMatchingEntities;
-                        for (std::size_t j = begin; j < end; ++j) {
-                            if (!isAlive(
-                                    multiMatchingEntities.at(index).at(j))) {
-                                fnDataAr[i].dead.insert(j);
-                            }
-                        }
+                        fnDataAr[i].alive = &aliveSnapshot;
                         threadPool->queueFn(
                             [&func](void* ud) {
                                 auto* data =
                                     static_cast<TPFnDataStructFive*>(ud);
                                 for (std::size_t i = data->range[0];
                                      i < data->range[1]; ++i) {
-                                    if (data->dead.find(i) ==
-                                        data->dead.end()) {
-                                        Helper::callPtr(
-                                            data->multiMatchingEntities
-                                                ->at(data->index)
-                                                .at(i),
-                                            *data->manager, func,
-                                            data->userData);
+                                    const std::size_t id =
+                                        (*data->multiMatchingEntities)
+                                            [data->index][i];
+                                    if (isAliveIn(*data->alive, id)) {
+                                        Helper::callPtr(id, *data->manager,
+                                                        func, data->userData);
                                     }
                                 }
                             },
-                            &fnDataAr[i]);
+                            &fnDataAr[i], batch);
                     }
-                    threadPool->easyStartAndWait();
+                    threadPool->easyStartAndWait(batch);
                 }
             });
 
-        // pop from idStack "call stack"
-        do {
-            {
-                std::lock_guard<std::mutex> lock(idStackMutex);
-                if (idStack.back() == current_id) {
-                    idStack.pop_back();
-                    break;
+        popIdStack(current_id);
+
+        handleDeferredDeletions();
+    }
+
+   private:
+    template <typename SigList, typename FTuple, std::size_t Index>
+    static void callFused(Manager& manager, std::size_t id, FTuple& fTuple,
+                          void* userData) {
+        using SignatureComponents = typename Internal::SignatureParameters<
+            EC::Meta::TypeListGet<SigList, Index>, ComponentsList>::type;
+        using Helper =
+            EC::Meta::Morph<SignatureComponents, ForMatchingSignatureHelper<> >;
+        Helper::call(id, manager, std::get<Index>(fTuple), userData);
+    }
+
+    template <typename SigList, typename FTuple, std::size_t... Indices>
+    static std::array<FusedCaller<FTuple>, sizeof...(Indices)> getFusedCallers(
+        std::index_sequence<Indices...>) {
+        return {{&callFused<SigList, FTuple, Indices>...}};
+    }
+
+    // calls the functions of the signatures matching each entity in
+    // [begin, end), entity by entity in order of ID, given the matching
+    // entities of each signature in order of ID
+    template <typename FTuple>
+    void callFusedRange(
+        std::size_t begin, std::size_t end,
+        const std::vector<std::vector<std::size_t> >& multiMatchingEntities,
+        const SignatureBitsets* signatureBitsets,
+        const FusedCaller<FTuple>* callers, FTuple& fTuple, void* userData,
+        const AliveBitmapType* alive) {
+        const std::size_t count = multiMatchingEntities.size();
+        std::vector<const std::size_t*> next(count);
+        std::vector<const std::size_t*> last(count);
+        for (std::size_t j = 0; j < count; ++j) {
+            const std::vector<std::size_t>& matching = multiMatchingEntities[j];
+            next[j] = matching.data() +
+                      (std::lower_bound(matching.begin(), matching.end(),
+                                        begin) -
+                       matching.begin());
+            last[j] = matching.data() + matching.size();
+        }
+
+        while (true) {
+            std::size_t id = end;
+            for (std::size_t j = 0; j < count; ++j) {
+                if (next[j] != last[j] && *next[j] < id) {
+                    id = *next[j];
+                }
+            }
+            if (id == end) {
+                break;
+            }
+            for (std::size_t j = 0; j < count; ++j) {
+                if (next[j] == last[j] || *next[j] != id) {
+                    continue;
                 }
+                ++next[j];
+                // an earlier function may have changed the entity
+                if ((alive ? isAliveIn(*alive, id) : isAlive(id)) &&
+                    signatureBitsets[j].matches(
+                        std::get<BitsetType>(entities[id]))) {
+                    callers[j](*this, id, fTuple, userData);
+                }
+            }
+        }
+    }
+
+   public:
+    /*!
+        \brief Calls multiple functions with multiple signatures, visiting
+        each entity once.
+
+        This takes the same parameters as forMatchingSignatures(), but
+        instead of calling the first function on all entities matching the
+        first signature, then the second function, and so on, it calls every
+        function whose signature matches an entity on that entity before
+        moving to the next entity. The Components of an entity are then
+        loaded into the cache once for all functions, which uses less memory
+        bandwidth when the entities do not fit in the cache.
+
+        Only use this when the functions do not depend on each other having
+        finished with all entities. The functions called on a single entity
+        are called in order of signatures, and a function is skipped if an
+        earlier function changed the entity so that it no longer matches the
+        function's signature.
+
+        If the third parameter is true, then the ThreadPool is used and
+        sections of entities are visited in parallel.
+
+        Example:
+        \code{.cpp}
+            manager.forMatchingSignaturesFused<TypeList<TypeList<C0>,
+                                                        TypeList<C0, C1>>>(
+                std::make_tuple(
+                    [] (std::size_t id, void* context, C0* c0) {},
+                    [] (std::size_t id, void* context, C0* c0, C1* c1) {}));
+        \endcode
+    */
+    template <typename SigList, typename FTuple>
+    void forMatchingSignaturesFused(FTuple fTuple, void* userData = nullptr,
+                                    const bool useThreadPool = false) {
+        const std::size_t current_id = pushIdStack();
+        deferringDeletions.fetch_add(1);
+        SignatureBitsets signatureBitsets[SigList::size];
+
+        // generate bitsets for each signature
+        EC::Meta::forEachWithIndex<SigList>(
+            [&signatureBitsets](auto signature, const auto index) {
+                signatureBitsets[index] =
+                    generateSignatureBitsets<decltype(signature)>();
+            });
+
+        // entities that are added while the functions run are skipped
+        ScratchLease aliveScratch(*this);
+        const AliveBitmapType& aliveSnapshot =
+            aliveScratch.getAliveSnapshot(usesThreadPool(useThreadPool));
+
+        std::vector<const SignatureBitsets*> signaturePtrs;
+        for (std::size_t i = 0; i < SigList::size; ++i) {
+            signaturePtrs.push_back(&signatureBitsets[i]);
+        }
+        const std::vector<std::vector<std::size_t> > multiMatchingEntities =
+            getMatchingEntities(signaturePtrs, useThreadPool);
+        const std::array<FusedCaller<FTuple>, SigList::size> callers =
+            getFusedCallers<SigList, FTuple>(
+                std::make_index_sequence<SigList::size>{});
+
+        if (!usesThreadPool(useThreadPool)) {
+            callFusedRange(0, currentSize, multiMatchingEntities,
+                           signatureBitsets, callers.data(), fTuple, userData,
+                           nullptr);
+        } else {
+            ScratchLease scratch(*this);
+            const std::vector<ChunkRange>& ranges =
+                scratch.getChunkRanges(currentSize);
+            TPFnDataStructSix<FTuple>* fnDataAr =
+                scratch.template getTaskData<TPFnDataStructSix<FTuple>>(
+                    ranges.size());
+            TPBatch batch;
+            for (std::size_t i = 0; i < ranges.size(); ++i) {
+                fnDataAr[i].range = ranges[i];
+                fnDataAr[i].manager = this;
+                fnDataAr[i].userData = userData;
+                fnDataAr[i].fTuple = &fTuple;
+                fnDataAr[i].callers = callers.data();
+                fnDataAr[i].multiMatchingEntities = &multiMatchingEntities;
+                fnDataAr[i].signatureBitsets = signatureBitsets;
+                fnDataAr[i].alive = &aliveSnapshot;
+                threadPool->queueFn(
+                    [](void* ud) {
+                        auto* data =
+                            static_cast<TPFnDataStructSix<FTuple>*>(ud);
+                        data->manager->callFusedRange(
+                            data->range[0], data->range[1],
+                            *data->multiMatchingEntities,
+                            data->signatureBitsets, data->callers,
+                            *data->fTuple, data->userData, data->alive);
+                    },
+                    &fnDataAr[i], batch);
             }
-            std::this_thread::sleep_for(std::chrono::microseconds(15));
-        } while (true);
+            threadPool->easyStartAndWait(batch);
+        }
+
+        popIdStack(current_id);
 
         handleDeferredDeletions();
     }
 
-    typedef void ForMatchingFn(std::size_t, Manager<ComponentsList, TagsList>*,
-                               void*);
+    typedef void ForMatchingFn(std::size_t, Manager*, void*);
+
+   private:
+    // shared by forMatchingSimple() and forMatchingIterable() when matching
+    // entities are not gathered first
+    void scanMatchingSimple(const SignatureBitsets& signatureBitset,
+                            ForMatchingFn fn, void* userData,
+                            const bool useThreadPool) {
+        const MatchScan scan = getMatchScan(signatureBitset);
+        if (!usesThreadPool(useThreadPool)) {
+            scanMatching(scan, 0, currentSize,
+                         [this, fn, userData](std::size_t id) {
+                             fn(id, this, userData);
+                         });
+            return;
+        }
+
+        ScratchLease scratch(*this);
+        const std::vector<ChunkRange>& ranges =
+            scratch.getChunkRanges(currentSize);
+        const AliveBitmapType& aliveSnapshot = scratch.getAliveSnapshot();
+        TPFnDataStructZero* fnDataAr =
+            scratch.template getTaskData<TPFnDataStructZero>(ranges.size());
+        TPBatch batch;
+
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            fnDataAr[i].range = ranges[i];
+            fnDataAr[i].manager = this;
+            fnDataAr[i].scan = &scan;
+            fnDataAr[i].userData = userData;
+            fnDataAr[i].alive = &aliveSnapshot;
+            threadPool->queueFn(
+                [fn](void* ud) {
+                    auto* data = static_cast<TPFnDataStructZero*>(ud);
+                    data->manager->scanMatching(
+                        *data->scan, data->range[0], data->range[1],
+                        [data, fn](std::size_t id) {
+                            if (isAliveIn(*data->alive, id)) {
+                                fn(id, data->manager, data->userData);
+                            }
+                        });
+                },
+                &fnDataAr[i], batch);
+        }
+        threadPool->easyStartAndWait(batch);
+    }
 
+   public:
     /*!
         \brief A simple version of forMatchingSignature()
 
@@ -1788,81 +4386,22 @@ struct Manager {
     template <typename Signature>
     void forMatchingSimple(ForMatchingFn fn, void* userData = nullptr,
                            const bool useThreadPool = false) {
-        std::size_t current_id;
-        {
-            // push to idStack "call stack"
-            std::lock_guard<std::mutex> lock(idStackMutex);
-            current_id = idStackCounter++;
-            idStack.push_back(current_id);
-        }
+        const std::size_t current_id = pushIdStack();
         deferringDeletions.fetch_add(1);
-        const BitsetType signatureBitset =
-            BitsetType::template generateBitset<Signature>();
-        if (!useThreadPool || !threadPool) {
-            for (std::size_t i = 0; i < currentSize; ++i) {
-                if (!std::get<bool>(entities[i])) {
-                    continue;
-                } else if ((signatureBitset &
-                            std::get<BitsetType>(entities[i])) ==
-                           signatureBitset) {
-                    fn(i, this, userData);
-                }
-            }
+        const SignatureBitsets signatureBitset =
+            generateSignatureBitsets<Signature>();
+        if (gatherMatchingFirst(useThreadPool)) {
+            const std::vector<std::size_t> matching =
+                getMatchingEntities({&signatureBitset}, useThreadPool)[0];
+            auto callFn = [this, fn, userData](std::size_t id) {
+                fn(id, this, userData);
+            };
+            callOnMatching(matching, callFn, useThreadPool);
         } else {
-            std::array<TPFnDataStructZero, ThreadCount * 2> fnDataAr;
-
-            std::size_t s = currentSize / (ThreadCount * 2);
-            for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                std::size_t begin = s * i;
-                std::size_t end;
-                if (i == ThreadCount * 2 - 1) {
-                    end = currentSize;
-                } else {
-                    end = s * (i + 1);
-                }
-                if (begin == end) {
-                    continue;
-                }
-                fnDataAr[i].range = {begin, end};
-                fnDataAr[i].manager = this;
-                fnDataAr[i].entities = &entities;
-                fnDataAr[i].signature = &signatureBitset;
-                fnDataAr[i].userData = userData;
-                for (std::size_t j = begin; j < end; ++j) {
-                    if (!isAlive(j)) {
-                        fnDataAr[i].dead.insert(j);
-                    }
-                }
-                threadPool->queueFn(
-                    [&fn](void* ud) {
-                        auto* data = static_cast<TPFnDataStructZero*>(ud);
-                        for (std::size_t i = data->range[0]; i < data->range[1];
-                             ++i) {
-                            if (data->dead.find(i) != data->dead.end()) {
-                                continue;
-                            } else if ((*data->signature &
-                                        std::get<BitsetType>(data->entities->at(
-                                            i))) == *data->signature) {
-                                fn(i, data->manager, data->userData);
-                            }
-                        }
-                    },
-                    &fnDataAr[i]);
-            }
-            threadPool->easyStartAndWait();
+            scanMatchingSimple(signatureBitset, fn, userData, useThreadPool);
         }
 
-        // pop from idStack "call stack"
-        do {
-            {
-                std::lock_guard<std::mutex> lock(idStackMutex);
-                if (idStack.back() == current_id) {
-                    idStack.pop_back();
-                    break;
-                }
-            }
-            std::this_thread::sleep_for(std::chrono::microseconds(15));
-        } while (true);
+        popIdStack(current_id);
 
         handleDeferredDeletions();
     }
@@ -1890,102 +4429,27 @@ struct Manager {
     void forMatchingIterable(Iterable iterable, ForMatchingFn fn,
                              void* userData = nullptr,
                              const bool useThreadPool = false) {
-        std::size_t current_id;
-        {
-            // push to idStack "call stack"
-            std::lock_guard<std::mutex> lock(idStackMutex);
-            current_id = idStackCounter++;
-            idStack.push_back(current_id);
-        }
+        const std::size_t current_id = pushIdStack();
 
         deferringDeletions.fetch_add(1);
-        if (!useThreadPool || !threadPool) {
-            bool isValid;
-            for (std::size_t i = 0; i < currentSize; ++i) {
-                if (!std::get<bool>(entities[i])) {
-                    continue;
-                }
-
-                isValid = true;
-                for (const auto& integralValue : iterable) {
-                    if (!std::get<BitsetType>(entities[i])
-                             .getCombinedBit(integralValue)) {
-                        isValid = false;
-                        break;
-                    }
-                }
-                if (!isValid) {
-                    continue;
-                }
-
-                fn(i, this, userData);
-            }
+        // Indices unknown to the Manager map to the last bit of the bitset
+        // which is never set, matching the behavior of getCombinedBit().
+        SignatureBitsets iterableBitset;
+        for (const auto& integralValue : iterable) {
+            iterableBitset.required.getCombinedBit(integralValue) = true;
+        }
+        if (gatherMatchingFirst(useThreadPool)) {
+            const std::vector<std::size_t> matching =
+                getMatchingEntities({&iterableBitset}, useThreadPool)[0];
+            auto callFn = [this, fn, userData](std::size_t id) {
+                fn(id, this, userData);
+            };
+            callOnMatching(matching, callFn, useThreadPool);
         } else {
-            std::array<TPFnDataStructSeven<Iterable>, ThreadCount * 2> fnDataAr;
-
-            std::size_t s = currentSize / (ThreadCount * 2);
-            for (std::size_t i = 0; i < ThreadCount * 2; ++i) {
-                std::size_t begin = s * i;
-                std::size_t end;
-                if (i == ThreadCount * 2 - 1) {
-                    end = currentSize;
-                } else {
-                    end = s * (i + 1);
-                }
-                if (begin == end) {
-                    continue;
-                }
-                fnDataAr[i].range = {begin, end};
-                fnDataAr[i].manager = this;
-                fnDataAr[i].entities = &entities;
-                fnDataAr[i].iterable = &iterable;
-                fnDataAr[i].userData = userData;
-                for (std::size_t j = begin; j < end; ++j) {
-                    if (!isAlive(j)) {
-                        fnDataAr[i].dead.insert(j);
-                    }
-                }
-                threadPool->queueFn(
-                    [&fn](void* ud) {
-                        auto* data =
-                            static_cast<TPFnDataStructSeven<Iterable>*>(ud);
-                        bool isValid;
-                        for (std::size_t i = data->range[0]; i < data->range[1];
-                             ++i) {
-                            if (data->dead.find(i) != data->dead.end()) {
-                                continue;
-                            }
-                            isValid = true;
-                            for (const auto& integralValue : *data->iterable) {
-                                if (!std::get<BitsetType>(data->entities->at(i))
-                                         .getCombinedBit(integralValue)) {
-                                    isValid = false;
-                                    break;
-                                }
-                            }
-                            if (!isValid) {
-                                continue;
-                            }
-
-                            fn(i, data->manager, data->userData);
-                        }
-                    },
-                    &fnDataAr[i]);
-            }
-            threadPool->easyStartAndWait();
+            scanMatchingSimple(iterableBitset, fn, userData, useThreadPool);
         }
 
-        // pop from idStack "call stack"
-        do {
-            {
-                std::lock_guard<std::mutex> lock(idStackMutex);
-                if (idStack.back() == current_id) {
-                    idStack.pop_back();
-                    break;
-                }
-            }
-            std::this_thread::sleep_for(std::chrono::microseconds(15));
-        } while (true);
+        popIdStack(current_id);
 
         handleDeferredDeletions();
     }
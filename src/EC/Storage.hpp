@@ -0,0 +1,439 @@
+#ifndef EC_STORAGE_HPP
+#define EC_STORAGE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace EC {
+
+namespace Internal {
+/*!
+    \brief A contiguous array of default constructed elements with an aligned
+    start.
+
+    Used internally by EC::ContiguousStorage. Unlike std::vector, the first
+    element is aligned to at least Alignment bytes, and the capacity grows
+    geometrically so that repeated calls to resize() with a slowly increasing
+    size are amortized.
+
+    Growing beyond capacity() moves all elements to a new allocation, which
+    invalidates pointers and references to the elements.
+*/
+template <typename T, std::size_t Alignment = 64>
+class AlignedColumn {
+   public:
+    static constexpr std::size_t ColumnAlignment =
+        Alignment > alignof(T) ? Alignment : alignof(T);
+
+    AlignedColumn()
+        : allocation(nullptr), elements(nullptr), count(0), cap(0) {}
+
+    ~AlignedColumn() {
+        clear();
+        ::operator delete(allocation);
+    }
+
+    // Disallow copy.
+    AlignedColumn(const AlignedColumn&) = delete;
+    AlignedColumn& operator=(const AlignedColumn&) = delete;
+
+    /// Resizes to the given size, default constructing new elements.
+    void resize(std::size_t newSize) {
+        if (newSize > cap) {
+            reserve(newSize > cap * 2 ? newSize : cap * 2);
+        }
+        for (std::size_t i = count; i < newSize; ++i) {
+            try {
+                new (elements + i) T();
+            } catch (...) {
+                for (std::size_t j = count; j < i; ++j) {
+                    elements[j].~T();
+                }
+                throw;
+            }
+        }
+        for (std::size_t i = newSize; i < count; ++i) {
+            elements[i].~T();
+        }
+        count = newSize;
+    }
+
+    /*!
+        \brief Ensures that the capacity is at least the given size.
+
+        Elements are moved if their move constructor is noexcept and copied
+        otherwise. If a copy throws, the column is left unchanged.
+    */
+    void reserve(std::size_t newCapacity) {
+        if (newCapacity <= cap) {
+            return;
+        }
+
+        void* newAllocation =
+            ::operator new(newCapacity * sizeof(T) + ColumnAlignment - 1);
+        T* newElements = reinterpret_cast<T*>(
+            (reinterpret_cast<std::uintptr_t>(newAllocation) +
+             ColumnAlignment - 1) &
+            ~static_cast<std::uintptr_t>(ColumnAlignment - 1));
+        std::size_t constructed = 0;
+        try {
+            for (; constructed < count; ++constructed) {
+                new (newElements + constructed)
+                    T(std::move_if_noexcept(elements[constructed]));
+            }
+        } catch (...) {
+            for (std::size_t i = 0; i < constructed; ++i) {
+                newElements[i].~T();
+            }
+            ::operator delete(newAllocation);
+            throw;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            elements[i].~T();
+        }
+        ::operator delete(allocation);
+
+        allocation = newAllocation;
+        elements = newElements;
+        cap = newCapacity;
+    }
+
+    /// Destroys all elements, keeping the capacity.
+    void clear() {
+        for (std::size_t i = 0; i < count; ++i) {
+            elements[i].~T();
+        }
+        count = 0;
+    }
+
+    T& operator[](std::size_t index) { return elements[index]; }
+    const T& operator[](std::size_t index) const { return elements[index]; }
+
+    T& at(std::size_t index) {
+        if (index >= count) {
+            throw std::out_of_range("AlignedColumn::at");
+        }
+        return elements[index];
+    }
+
+    const T& at(std::size_t index) const {
+        if (index >= count) {
+            throw std::out_of_range("AlignedColumn::at");
+        }
+        return elements[index];
+    }
+
+    T* data() { return elements; }
+    const T* data() const { return elements; }
+
+    std::size_t size() const { return count; }
+    std::size_t capacity() const { return cap; }
+
+   private:
+    void* allocation;
+    T* elements;
+    std::size_t count;
+    std::size_t cap;
+};
+
+/*!
+    \brief A paged column storing elements only for the pages of entities
+    that own them.
+
+    Used internally for Components with EC::SparseStoragePolicy, which
+    describes its memory use. Entity IDs are grouped into pages of PageSize
+    IDs, and a page is only allocated once one of its entities has an
+    element.
+
+    Elements are never moved once stored, so a pointer to an element stays
+    valid until that element is erased. insert(), erase(), find() and
+    growing the range of IDs with resize() may be called concurrently for
+    different entity IDs (as from the callbacks of a multi-threaded
+    "forMatching" call that add entities), while shrinking the range of IDs
+    and clear() must not be called concurrently with anything else.
+*/
+template <typename T>
+class SparseColumn {
+   public:
+    static constexpr std::size_t PageSize = 16;
+    static_assert(PageSize <= 64, "the slots of a page are a 64 bit mask");
+
+    SparseColumn() : table(nullptr), elements(0) {
+        publishTable(std::unique_ptr<PageTable>(new PageTable(0)));
+    }
+
+    ~SparseColumn() { clear(); }
+
+    // Disallow copy.
+    SparseColumn(const SparseColumn&) = delete;
+    SparseColumn& operator=(const SparseColumn&) = delete;
+
+    /// Resizes the range of entity IDs, erasing elements of removed IDs.
+    void resize(std::size_t newSize) {
+        const PageTable* current = table.load(std::memory_order_acquire);
+        if (newSize == current->idCount) {
+            return;
+        }
+        for (std::size_t id = newSize; id < current->idCount; ++id) {
+            erase(id);
+        }
+        const std::size_t newPageCount = (newSize + PageSize - 1) / PageSize;
+        std::lock_guard<std::mutex> lock(pageMutex);
+        // pages are only allocated while holding pageMutex, so none is
+        // missed by the copy
+        std::unique_ptr<PageTable> newTable(new PageTable(newPageCount));
+        newTable->idCount = newSize;
+        for (std::size_t i = 0; i < newPageCount; ++i) {
+            newTable->pages[i].store(
+                i < current->pageCount ? current->pages[i].load() : nullptr);
+        }
+        for (std::size_t i = newPageCount; i < current->pageCount; ++i) {
+            delete current->pages[i].load();
+        }
+        publishTable(std::move(newTable));
+    }
+
+    /// Returns the element of the given entity, or nullptr if it has none.
+    T* find(std::size_t id) {
+        Page* page = getPage(id);
+        if (!page || !page->has(id % PageSize)) {
+            return nullptr;
+        }
+        return page->element(id % PageSize);
+    }
+
+    /// Returns the element of the given entity, or nullptr if it has none.
+    const T* find(std::size_t id) const {
+        return const_cast<SparseColumn*>(this)->find(id);
+    }
+
+    /// Stores the given element for the given entity, replacing any old one.
+    template <typename Value>
+    void insert(std::size_t id, Value&& value) {
+        Page* page = getPage(id);
+        if (!page) {
+            page = allocatePage(id / PageSize);
+        }
+        const std::size_t slot = id % PageSize;
+        if (page->has(slot)) {
+            *page->element(slot) = std::forward<Value>(value);
+        } else {
+            new (page->element(slot)) T(std::forward<Value>(value));
+            page->present.fetch_or(std::uint64_t(1) << slot,
+                                   std::memory_order_release);
+            elements.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /*!
+        \brief Erases the element of the given entity.
+
+        No other element is moved, so pointers to the elements of other
+        entities stay valid.
+
+        \return False if the entity had no element.
+    */
+    bool erase(std::size_t id) {
+        Page* page = getPage(id);
+        const std::size_t slot = id % PageSize;
+        if (!page || !page->has(slot)) {
+            return false;
+        }
+        page->element(slot)->~T();
+        page->present.fetch_and(~(std::uint64_t(1) << slot),
+                                std::memory_order_release);
+        elements.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Erases all elements and frees their pages, keeping the range of IDs.
+    void clear() {
+        const PageTable* current = table.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < current->pageCount; ++i) {
+            Page* page = current->pages[i].load();
+            if (!page) {
+                continue;
+            }
+            for (std::size_t slot = 0; slot < PageSize; ++slot) {
+                if (page->has(slot)) {
+                    page->element(slot)->~T();
+                }
+            }
+            delete page;
+            current->pages[i].store(nullptr);
+        }
+        elements.store(0);
+        // nothing uses the tables replaced by resize() anymore
+        tables.erase(tables.begin(), tables.end() - 1);
+    }
+
+    /// Returns the size of the range of entity IDs.
+    std::size_t size() const {
+        return table.load(std::memory_order_acquire)->idCount;
+    }
+
+    /// Returns the number of stored elements.
+    std::size_t count() const { return elements.load(); }
+
+   private:
+    struct Page {
+        Page() : present(0) {}
+
+        bool has(std::size_t slot) const {
+            return (present.load(std::memory_order_acquire) >> slot) & 1;
+        }
+
+        T* element(std::size_t slot) {
+            return reinterpret_cast<T*>(&slots[slot]);
+        }
+
+        std::atomic<std::uint64_t> present;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type
+            slots[PageSize];
+    };
+
+    // The pages of a range of IDs. A table is replaced instead of changed
+    // when the range changes, and the replaced tables are kept until
+    // clear(), so a thread can keep using the table it loaded while
+    // another thread grows the range.
+    struct PageTable {
+        explicit PageTable(std::size_t count)
+            : pages(new std::atomic<Page*>[count]),
+              pageCount(count),
+              idCount(0) {
+            for (std::size_t i = 0; i < count; ++i) {
+                pages[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        std::unique_ptr<std::atomic<Page*>[]> pages;
+        std::size_t pageCount;
+        std::size_t idCount;
+    };
+
+    std::vector<std::unique_ptr<PageTable> > tables;
+    std::atomic<PageTable*> table;
+    std::atomic_size_t elements;
+    std::mutex pageMutex;
+
+    void publishTable(std::unique_ptr<PageTable> newTable) {
+        table.store(newTable.get(), std::memory_order_release);
+        tables.push_back(std::move(newTable));
+    }
+
+    Page* getPage(std::size_t id) const {
+        const PageTable* current = table.load(std::memory_order_acquire);
+        if (id >= current->idCount) {
+            return nullptr;
+        }
+        return current->pages[id / PageSize].load(std::memory_order_acquire);
+    }
+
+    // Allocates a missing page in the current table, once even if called
+    // concurrently.
+    Page* allocatePage(std::size_t index) {
+        std::lock_guard<std::mutex> lock(pageMutex);
+        PageTable* current = table.load(std::memory_order_acquire);
+        Page* page = current->pages[index].load(std::memory_order_acquire);
+        if (!page) {
+            page = new Page();
+            current->pages[index].store(page, std::memory_order_release);
+        }
+        return page;
+    }
+};
+}  // namespace Internal
+
+/*!
+    \brief Storage policy where a Component has a slot for every entity.
+
+    This is the default for all Components. How the slots are stored is
+    chosen by the storage mode of EC::Manager (see EC::DequeStorage and
+    EC::ContiguousStorage).
+*/
+struct DenseStoragePolicy {};
+
+/*!
+    \brief Storage policy where a Component is stored in pages that are only
+    allocated for the entities that own it.
+
+    Entity IDs are grouped into pages of 16 IDs, and a page of 16 Component
+    slots is only allocated once one of its entities owns the Component. The
+    memory used is at most one pointer per 16 entity IDs plus one page per
+    owner, and owners with nearby IDs share pages. For example, a Component
+    owned by 0.1% of the entities takes at most 1.6% of the memory of
+    EC::DenseStoragePolicy, plus half a byte per entity ID for the pointers
+    on 64-bit targets. Getting a Component of an entity is an additional
+    indirection compared to EC::DenseStoragePolicy.
+
+    EC::Manager::getEntityData() returns nullptr for an entity that does not
+    own a Component with this policy. Components are never moved, so adding
+    or removing the Component of one entity (even from the callbacks of a
+    multi-threaded "forMatching" call) leaves pointers to the Components of
+    other entities valid.
+*/
+struct SparseStoragePolicy {};
+
+/*!
+    \brief Selects the storage policy of a Component.
+
+    Specialize this to select EC::SparseStoragePolicy for a Component.
+
+    Example:
+    \code{.cpp}
+        namespace EC {
+        template <>
+        struct StoragePolicy<RareComponent> {
+            using type = EC::SparseStoragePolicy;
+        };
+        }
+    \endcode
+*/
+template <typename Component>
+struct StoragePolicy {
+    using type = DenseStoragePolicy;
+};
+
+/*!
+    \brief Storage mode of EC::Manager where components and entity info are
+    stored in std::deques.
+
+    This is the default. Pointers to components (as returned by
+    getEntityData()) stay valid when the Manager grows to hold more entities.
+*/
+struct DequeStorage {
+    template <typename T>
+    using Column = std::deque<T>;
+};
+
+/*!
+    \brief Storage mode of EC::Manager where each component and the entity
+    info are stored in a contiguous array aligned to a cache line.
+
+    Iterating over entities then walks contiguous memory, which is friendlier
+    to vectorization and prefetching than the chunks of a std::deque.
+
+    Note that pointers to components (as returned by getEntityData()) are
+    invalidated whenever the Manager grows beyond its current capacity, which
+    can happen during addEntity(). Use EC::Manager::reserve() to keep pointers
+    valid up to a known number of entities. In particular, addEntity() must
+    not grow the Manager during a multi-threaded call to one of the
+    "forMatching" functions.
+*/
+struct ContiguousStorage {
+    template <typename T>
+    using Column = Internal::AlignedColumn<T>;
+};
+
+}  // namespace EC
+
+#endif
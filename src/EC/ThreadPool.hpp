@@ -2,15 +2,16 @@
 #define EC_META_SYSTEM_THREADPOOL_HPP
 
 #include <atomic>
-#include <chrono>
-#include <deque>
-#include <functional>
-#include <list>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #ifndef NDEBUG
@@ -19,38 +20,301 @@
 
 namespace EC {
 
+template <unsigned int MAXSIZE>
+class ThreadPool;
+
+/*!
+    \brief A group of functions queued to a ThreadPool that can be waited on
+    on its own.
+
+    Functions are added to a batch by giving it to ThreadPool::queueFn(), and
+    ThreadPool::easyStartAndWait() given the batch only waits until those
+    functions have finished. This allows multiple callers (or nested callers
+    within queued functions) to share one ThreadPool.
+
+    A batch must not be destroyed while any of its functions have not
+    finished.
+*/
+class TPBatch {
+   public:
+    TPBatch() : pending(0), mutex{}, cv{} {}
+
+    TPBatch(const TPBatch &) = delete;
+    TPBatch &operator=(const TPBatch &) = delete;
+
+    /// Returns the number of functions of this batch that have not finished.
+    std::size_t getPendingCount() const { return pending.load(); }
+
+    /*!
+        \brief Blocks until every function queued with this batch has
+        finished.
+
+        Unlike ThreadPool::easyStartAndWait(), this neither starts the queued
+        functions nor runs any of them on the calling thread.
+    */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return pending.load() == 0; });
+    }
+
+   private:
+    template <unsigned int MAXSIZE>
+    friend class ThreadPool;
+
+    std::atomic_size_t pending;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // Called when a function is queued with this batch.
+    void add() {
+        // Transitions from zero are done while holding the mutex so that a
+        // waiter always sees a consistent count.
+        std::size_t count = pending.load();
+        while (count != 0) {
+            if (pending.compare_exchange_weak(count, count + 1)) {
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.fetch_add(1);
+    }
+
+    // Called when a function queued with this batch has finished.
+    void finish() {
+        std::size_t count = pending.load();
+        while (count > 1) {
+            if (pending.compare_exchange_weak(count, count - 1)) {
+                return;
+            }
+        }
+        // The last function of the batch wakes the waiter. The waiter only
+        // returns after acquiring the mutex, so the batch is not destroyed
+        // until this notification has completed.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.fetch_sub(1) == 1) {
+            cv.notify_all();
+        }
+    }
+};
+
 namespace Internal {
-using TPFnType = std::function<void(void *)>;
-using TPTupleType = std::tuple<TPFnType, void *>;
-using TPQueueType = std::queue<TPTupleType>;
+/*!
+    \brief A queued function and its context, stored without allocating.
+
+    Callables that are trivially copyable and fit in the inline storage (such
+    as plain function pointers and lambdas capturing a few pointers or
+    references) are stored inline. Any other callable is moved to the heap.
+*/
+struct TPTask {
+    static constexpr std::size_t StorageSize = 4 * sizeof(void *);
+
+    template <typename Function>
+    static constexpr bool isStoredInline() {
+        return sizeof(Function) <= StorageSize &&
+               alignof(Function) <= alignof(std::max_align_t) &&
+               std::is_trivially_copyable<Function>::value;
+    }
+
+    template <typename Function>
+    void set(Function &&function, void *userData, TPBatch *taskBatch) {
+        using Fn = typename std::decay<Function>::type;
+        setFn<Fn>(std::forward<Function>(function),
+                  std::integral_constant<bool, isStoredInline<Fn>()>{});
+        ud = userData;
+        batch = taskBatch;
+    }
+
+    /// Calls the stored function and releases it, even if it throws.
+    void run() {
+        struct Release {
+            TPTask &task;
+            ~Release() {
+                if (task.destroy) {
+                    task.destroy(task);
+                }
+            }
+        } release{*this};
+        invoke(*this);
+    }
+
+    void (*invoke)(TPTask &);
+    void (*destroy)(TPTask &);
+    void *ud;
+    TPBatch *batch;
+    alignas(std::max_align_t) unsigned char storage[StorageSize];
+
+   private:
+    template <typename Fn, typename Function>
+    void setFn(Function &&function, std::true_type) {
+        new (storage) Fn(std::forward<Function>(function));
+        invoke = [](TPTask &task) {
+            (*reinterpret_cast<Fn *>(task.storage))(task.ud);
+        };
+        destroy = nullptr;
+    }
+
+    template <typename Fn, typename Function>
+    void setFn(Function &&function, std::false_type) {
+        *reinterpret_cast<Fn **>(storage) =
+            new Fn(std::forward<Function>(function));
+        invoke = [](TPTask &task) {
+            (**reinterpret_cast<Fn **>(task.storage))(task.ud);
+        };
+        destroy = [](TPTask &task) {
+            delete *reinterpret_cast<Fn **>(task.storage);
+        };
+    }
+};
+
+/*!
+    \brief A growable ring buffer of TPTask used as a double-ended queue.
+
+    Capacity is a power of two and only grows (by doubling) when full, so a
+    ThreadPool that has warmed up queues functions without allocating.
+*/
+class TPRingBuffer {
+   public:
+    explicit TPRingBuffer(std::size_t capacity = 64)
+        : buffer(capacity), head(0), tail(0) {}
+
+    bool empty() const { return head == tail; }
+
+    void push_back(const TPTask &task) {
+        if (tail - head == buffer.size()) {
+            grow();
+        }
+        buffer[tail & (buffer.size() - 1)] = task;
+        ++tail;
+    }
+
+    TPTask pop_back() {
+        --tail;
+        return buffer[tail & (buffer.size() - 1)];
+    }
+
+    TPTask pop_front() {
+        TPTask task = buffer[head & (buffer.size() - 1)];
+        ++head;
+        return task;
+    }
+
+   private:
+    std::vector<TPTask> buffer;
+    std::size_t head;
+    std::size_t tail;
+
+    void grow() {
+        std::vector<TPTask> newBuffer(buffer.size() * 2);
+        for (std::size_t i = head; i != tail; ++i) {
+            newBuffer[i - head] = buffer[i & (buffer.size() - 1)];
+        }
+        tail -= head;
+        head = 0;
+        buffer.swap(newBuffer);
+    }
+};
+
+/*!
+    \brief A deque of queued functions owned by one worker thread.
+
+    Newly queued functions wait in pending until startThreads() moves them to
+    tasks, which is the only deque that functions are taken from.
+*/
+struct TPWorkQueue {
+    std::mutex mutex;
+    TPRingBuffer tasks;
+    TPRingBuffer pending;
+};
+using TPWorkQueuesType = std::vector<std::unique_ptr<TPWorkQueue>>;
+
+/// Identifies the ThreadPool worker (if any) running on the current thread.
+struct TPWorkerInfo {
+    const void *pool;
+    unsigned int index;
+};
+
+inline TPWorkerInfo &getTPWorkerInfo() {
+    static thread_local TPWorkerInfo info{nullptr, 0};
+    return info;
+}
+
+// The return type of ThreadPool::startThreads(), kept for compatibility with
+// callers of the ThreadPool that spawned threads on every startThreads().
 using ThreadPtr = std::unique_ptr<std::thread>;
 using ThreadStackType = std::vector<std::tuple<ThreadPtr, std::thread::id>>;
-using ThreadStacksType = std::deque<ThreadStackType>;
-using ThreadStacksMutexesT = std::deque<std::mutex>;
-using ThreadCountersT = std::deque<std::atomic_uint>;
-using PtrsHoldT = std::deque<std::atomic_bool>;
 using PointersT = std::tuple<ThreadStackType *, std::mutex *,
                              std::atomic_uint *, std::atomic_bool *>;
 }  // namespace Internal
 
+/*!
+    \brief A thread count that is resolved at runtime to
+    std::thread::hardware_concurrency().
+
+    May be given as the MAXSIZE of a ThreadPool, the ThreadCount of a Manager,
+    or to their setThreadCount() functions.
+*/
+constexpr unsigned int HardwareThreadCount = 0xFFFFFFFF;
+
+namespace Internal {
+/// Returns the number of threads to use for the requested thread count.
+inline unsigned int resolveThreadCount(unsigned int threadCount) {
+    if (threadCount == HardwareThreadCount) {
+        const unsigned int hardwareCount = std::thread::hardware_concurrency();
+        return hardwareCount == 0 ? 1 : hardwareCount;
+    }
+    return threadCount;
+}
+}  // namespace Internal
+
 /*!
     \brief Implementation of a Thread Pool.
 
-    Note that MAXSIZE template parameter determines how many threads are created
-    each time that startThreads() (or easyStartAndWait()) is called.
+    Note that MAXSIZE template parameter determines how many worker threads
+    are created when the ThreadPool is default constructed. If MAXSIZE is
+    HardwareThreadCount, then std::thread::hardware_concurrency() threads are
+    created. The thread count can be changed afterwards with setThreadCount().
+    The worker threads persist until the ThreadPool is destroyed (or the
+    thread count is changed) and sleep until startThreads() (or
+    easyStartAndWait()) is called. If the thread count is less than 2, then no
+    worker threads are created and queued functions are executed on the
+    calling thread.
+
+    Queued functions are scheduled with work-stealing. Each worker thread owns
+    a deque of functions. Functions queued from within a worker thread go to
+    that worker's deque, while functions queued from any other thread are
+    distributed round-robin across the deques. A worker takes functions from
+    the back of its own deque, and once it is empty it steals from the front
+    of the other workers' deques.
 */
 template <unsigned int MAXSIZE>
 class ThreadPool {
    public:
-    ThreadPool()
-        : threadStacks{}, threadStackMutexes{}, fnQueue{}, queueMutex{} {}
+    ThreadPool() : ThreadPool(MAXSIZE) {}
 
-    ~ThreadPool() {
-        while (!isNotRunning()) {
-            std::this_thread::sleep_for(std::chrono::microseconds(30));
-        }
+    /*!
+        \brief Creates the ThreadPool with the given number of threads instead
+        of MAXSIZE.
+    */
+    explicit ThreadPool(unsigned int threadCount)
+        : workers{},
+          queues{},
+          sleepMutex{},
+          workerCV{},
+          defaultBatch{},
+          threadCount(0),
+          stopping(false),
+          pendingCount(0),
+          queuedCount(0),
+          runningCount(0),
+          nextQueue(0) {
+        startWorkers(Internal::resolveThreadCount(threadCount));
     }
 
+    ~ThreadPool() { stopWorkers(); }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
     /*!
         \brief Queues a function to be called (doesn't start calling yet).
 
@@ -58,100 +322,69 @@ class ThreadPool {
         waiting threads which will start pulling functions from the queue to be
         called.
 
+        The function must be callable with a single void* parameter. Function
+        pointers and small trivially copyable lambdas are stored inline
+        without any heap allocation; other callables (such as std::function)
+        are moved to the heap.
+
+        If a function throws while it runs on a thread calling startThreads()
+        or easyStartAndWait(), the other functions still run and the first
+        exception is rethrown from that call once they have (once the batch
+        has finished for easyStartAndWait()). A function that throws on a
+        worker thread terminates the program, as with std::thread.
+
         Note that the easyStartAndWait() calls startThreads() and waits until
-        the threads have finished execution.
+        the queued functions have finished execution.
+    */
+    template <typename Function>
+    void queueFn(Function &&fn, void *ud = nullptr) {
+        queueFn(std::forward<Function>(fn), ud, defaultBatch);
+    }
+
+    /*!
+        \brief Queues a function as part of the given batch.
+
+        easyStartAndWait() with the same batch will only wait on the functions
+        queued with that batch, which allows multiple callers (or nested
+        callers within queued functions) to share one ThreadPool.
     */
-    void queueFn(std::function<void(void *)> &&fn, void *ud = nullptr) {
-        std::lock_guard<std::mutex> lock(queueMutex);
-        fnQueue.emplace(std::make_tuple(fn, ud));
+    template <typename Function>
+    void queueFn(Function &&fn, void *ud, TPBatch &batch) {
+        Internal::TPTask task;
+        task.set(std::forward<Function>(fn), ud, &batch);
+        batch.add();
+        Internal::TPWorkQueue &queue = *queues[getSubmitIndex()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.pending.push_back(task);
+        }
+        pendingCount.fetch_add(1);
     }
 
     /*!
-        \brief Creates MAXSIZE threads that will process queueFn() functions.
+        \brief Wakes the worker threads to process queueFn() functions.
+
+        Only the functions queued before this call are started. Functions
+        queued afterwards wait for the next call to startThreads() (or
+        easyStartAndWait()).
 
-        Note that if MAXSIZE < 2, then this function will synchronously execute
-        the queued functions and block until the functions have been executed.
-        Otherwise, this function may return before the queued functions have
-        been executed.
+        Note that if there are less than 2 threads, then this function will
+        synchronously execute the queued functions and block until the
+        functions have been executed. Otherwise, this function may return
+        before the queued functions have been executed.
+
+        \deprecated The returned pointers are always null, as the worker
+        threads are no longer created by this call. The return type will
+        become void, use isQueueEmpty() and isNotRunning() or
+        easyStartAndWait() to find out when the functions have finished.
      */
     Internal::PointersT startThreads() {
-        if (MAXSIZE >= 2) {
-            checkStacks();
-            auto pointers = newStackEntry();
-            Internal::ThreadStackType *threadStack = std::get<0>(pointers);
-            std::mutex *threadStackMutex = std::get<1>(pointers);
-            std::atomic_uint *aCounter = std::get<2>(pointers);
-            for (unsigned int i = 0; i < MAXSIZE; ++i) {
-                std::thread *newThread = new std::thread(
-                    [](Internal::ThreadStackType *threadStack,
-                       std::mutex *threadStackMutex,
-                       Internal::TPQueueType *fnQueue, std::mutex *queueMutex,
-                       std::atomic_uint *initCount) {
-                        // add id to idStack "call stack"
-                        {
-                            std::lock_guard<std::mutex> lock(*threadStackMutex);
-                            threadStack->push_back(
-                                {Internal::ThreadPtr(nullptr),
-                                 std::this_thread::get_id()});
-                        }
-
-                        ++(*initCount);
-
-                        // fetch queued fns and execute them
-                        // fnTuples must live until end of function
-                        std::list<Internal::TPTupleType> fnTuples;
-                        do {
-                            bool fnFound = false;
-                            {
-                                std::lock_guard<std::mutex> lock(*queueMutex);
-                                if (!fnQueue->empty()) {
-                                    fnTuples.emplace_back(
-                                        std::move(fnQueue->front()));
-                                    fnQueue->pop();
-                                    fnFound = true;
-                                }
-                            }
-                            if (fnFound) {
-                                std::get<0>(fnTuples.back())(
-                                    std::get<1>(fnTuples.back()));
-                            } else {
-                                break;
-                            }
-                        } while (true);
-
-                        // pop id from idStack "call stack"
-                        do {
-                            std::this_thread::sleep_for(
-                                std::chrono::microseconds(15));
-                            if (initCount->load() != MAXSIZE) {
-                                continue;
-                            }
-                            {
-                                std::lock_guard<std::mutex> lock(
-                                    *threadStackMutex);
-                                if (std::get<1>(threadStack->back()) ==
-                                    std::this_thread::get_id()) {
-                                    if (!std::get<0>(threadStack->back())) {
-                                        continue;
-                                    }
-                                    std::get<0>(threadStack->back())->detach();
-                                    threadStack->pop_back();
-                                    break;
-                                }
-                            }
-                        } while (true);
-                    },
-                    threadStack, threadStackMutex, &fnQueue, &queueMutex,
-                    aCounter);
-                // Wait until thread has pushed to threadStack before setting
-                // the handle to it
-                while (aCounter->load() != i + 1) {
-                    std::this_thread::sleep_for(std::chrono::microseconds(15));
-                }
-                std::lock_guard<std::mutex> stackLock(*threadStackMutex);
-                std::get<0>(threadStack->at(i)).reset(newThread);
-            }
-            return pointers;
+        releaseTasks();
+        if (threadCount >= 2) {
+            // Synchronize with workers about to sleep so the wake-up is not
+            // lost.
+            { std::lock_guard<std::mutex> lock(sleepMutex); }
+            workerCV.notify_all();
         } else {
             sequentiallyRunTasks();
         }
@@ -162,147 +395,246 @@ class ThreadPool {
         \brief Returns true if the function queue is empty.
     */
     bool isQueueEmpty() {
-        std::lock_guard<std::mutex> lock(queueMutex);
-        return fnQueue.empty();
+        // Released functions are counted as queued before they stop being
+        // counted as pending, so pendingCount is read first.
+        return pendingCount.load() == 0 && queuedCount.load() == 0;
     }
 
     /*!
         \brief Returns the MAXSIZE count that this class was created with.
+
+        If MAXSIZE is HardwareThreadCount, then the resolved
+        std::thread::hardware_concurrency() count (at least 1) is returned.
+        Note that this is based on the template parameter, see
+        getThreadCount() for the number of threads currently in use. Unless
+        MAXSIZE is HardwareThreadCount, this is a constant expression.
+     */
+    constexpr unsigned int getMaxThreadCount() const {
+        return MAXSIZE != HardwareThreadCount
+                   ? MAXSIZE
+                   : Internal::resolveThreadCount(MAXSIZE);
+    }
+
+    /*!
+        \brief Returns the number of worker threads currently in use.
      */
-    constexpr unsigned int getMaxThreadCount() { return MAXSIZE; }
+    unsigned int getThreadCount() const { return threadCount; }
 
     /*!
-        \brief Calls startThreads() and waits until all threads have finished.
+        \brief Changes the number of worker threads.
+
+        The current worker threads finish any queued functions and are
+        joined, then the new worker threads are created. The given count may
+        be HardwareThreadCount.
+
+        This must only be called while the ThreadPool is idle, and never from
+        within a queued function.
+     */
+    void setThreadCount(unsigned int count) {
+        stopWorkers();
+        startWorkers(Internal::resolveThreadCount(count));
+    }
 
-        Regardless of the value set to MAXSIZE, this function will block until
+    /*!
+        \brief Calls startThreads() and waits until all functions queued
+        without a batch have finished.
+
+        Regardless of the thread count, this function will block until
         all previously queued functions have been executed.
      */
-    void easyStartAndWait() {
-        if (MAXSIZE >= 2) {
-            Internal::PointersT pointers = startThreads();
-            do {
-                std::this_thread::sleep_for(std::chrono::microseconds(30));
-
-                bool isQueueEmpty = false;
-                {
-                    std::lock_guard<std::mutex> lock(queueMutex);
-                    isQueueEmpty = fnQueue.empty();
-                }
+    void easyStartAndWait() { easyStartAndWait(defaultBatch); }
 
-                if (isQueueEmpty) {
-                    break;
-                }
-            } while (true);
-            if (std::get<0>(pointers)) {
-                do {
-                    {
-                        std::lock_guard<std::mutex> lock(
-                            *std::get<1>(pointers));
-                        if (std::get<0>(pointers)->empty()) {
-                            std::get<3>(pointers)->store(false);
-                            break;
-                        }
-                    }
-                    std::this_thread::sleep_for(std::chrono::microseconds(15));
-                } while (true);
-            }
-        } else {
-            sequentiallyRunTasks();
+    /*!
+        \brief Calls startThreads() and waits until all functions queued with
+        the given batch have finished.
+
+        The calling thread does not sit idle while it waits. It pulls queued
+        functions and executes them alongside the worker threads until the
+        batch has no more functions left to start, then sleeps until the last
+        function of the batch wakes it. This also means a nested call (from
+        within a queued function) always makes progress even if every worker
+        thread is busy.
+
+        With less than 2 threads, startThreads() runs the queued functions on
+        the calling thread, but another thread calling startThreads() on the
+        same ThreadPool may have taken some of them, so this still waits
+        until that thread has finished them.
+     */
+    void easyStartAndWait(TPBatch &batch) {
+        std::exception_ptr error;
+        try {
+            startThreads();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        while (batch.getPendingCount() != 0 && runOneTask(error)) {
+        }
+        // functions of the batch on other threads may still use the
+        // caller's data, so this waits for them even if a function threw
+        batch.wait();
+        if (error) {
+            std::rethrow_exception(error);
         }
     }
 
     /*!
-        \brief Checks if any threads are currently running, returning true if
-        there are no threads running.
+        \brief Checks if any queued functions are currently being executed,
+        returning true if there are none.
      */
-    bool isNotRunning() {
-        std::lock_guard<std::mutex> lock(dequesMutex);
-        auto tIter = threadStacks.begin();
-        auto mIter = threadStackMutexes.begin();
-        while (tIter != threadStacks.end() &&
-               mIter != threadStackMutexes.end()) {
-            {
-                std::lock_guard<std::mutex> lock(*mIter);
-                if (!tIter->empty()) {
-                    return false;
-                }
+    bool isNotRunning() { return runningCount.load() == 0; }
+
+   private:
+    std::vector<std::thread> workers;
+    Internal::TPWorkQueuesType queues;
+    std::mutex sleepMutex;
+    std::condition_variable workerCV;
+    TPBatch defaultBatch;
+    unsigned int threadCount;
+    bool stopping;
+    std::atomic_size_t pendingCount;
+    std::atomic_size_t queuedCount;
+    std::atomic_uint runningCount;
+    std::atomic_uint nextQueue;
+
+    void startWorkers(unsigned int count) {
+        threadCount = count;
+        stopping = false;
+        queues.clear();
+        for (unsigned int i = 0; i < (count >= 2 ? count : 1); ++i) {
+            queues.emplace_back(std::make_unique<Internal::TPWorkQueue>());
+        }
+        if (count >= 2) {
+            for (unsigned int i = 0; i < count; ++i) {
+                workers.emplace_back([this, i]() { workerLoop(i); });
             }
-            ++tIter;
-            ++mIter;
         }
-        return true;
     }
 
-   private:
-    Internal::ThreadStacksType threadStacks;
-    Internal::ThreadStacksMutexesT threadStackMutexes;
-    Internal::TPQueueType fnQueue;
-    std::mutex queueMutex;
-    Internal::ThreadCountersT threadCounters;
-    Internal::PtrsHoldT ptrsHoldBools;
-    std::mutex dequesMutex;
+    void stopWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        workerCV.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        // run anything left over so that no batch is left waiting
+        releaseTasks();
+        sequentiallyRunTasks();
+    }
 
-    void sequentiallyRunTasks() {
-        // pull functions from queue and run them on current thread
-        Internal::TPTupleType fnTuple;
-        bool hasFn;
-        do {
-            {
-                std::lock_guard<std::mutex> lock(queueMutex);
-                if (!fnQueue.empty()) {
-                    hasFn = true;
-                    fnTuple = fnQueue.front();
-                    fnQueue.pop();
-                } else {
-                    hasFn = false;
-                }
+    void workerLoop(unsigned int index) {
+        Internal::getTPWorkerInfo() = {this, index};
+        while (true) {
+            if (runOneTask()) {
+                continue;
             }
-            if (hasFn) {
-                std::get<0>(fnTuple)(std::get<1>(fnTuple));
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            workerCV.wait(lock, [this]() {
+                return stopping || queuedCount.load() != 0;
+            });
+            if (stopping) {
+                break;
             }
-        } while (hasFn);
+        }
     }
 
-    void checkStacks() {
-        std::lock_guard<std::mutex> lock(dequesMutex);
-        if (threadStacks.empty()) {
+    // Moves every pending function to its deque's runnable tasks.
+    void releaseTasks() {
+        if (pendingCount.load() == 0) {
             return;
         }
+        for (auto &queuePtr : queues) {
+            Internal::TPWorkQueue &queue = *queuePtr;
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            std::size_t count = 0;
+            while (!queue.pending.empty()) {
+                queue.tasks.push_back(queue.pending.pop_front());
+                ++count;
+            }
+            queuedCount.fetch_add(count);
+            pendingCount.fetch_sub(count);
+        }
+    }
 
-        bool erased = false;
-        do {
-            erased = false;
-            {
-                std::lock_guard<std::mutex> lock(threadStackMutexes.front());
-                if (ptrsHoldBools.front().load()) {
-                    break;
-                } else if (threadStacks.front().empty()) {
-                    threadStacks.pop_front();
-                    threadCounters.pop_front();
-                    ptrsHoldBools.pop_front();
-                    erased = true;
-                }
+    // Workers submit to their own deque, other threads round-robin.
+    unsigned int getSubmitIndex() {
+        const Internal::TPWorkerInfo &info = Internal::getTPWorkerInfo();
+        if (info.pool == this) {
+            return info.index;
+        }
+        return nextQueue.fetch_add(1) % queues.size();
+    }
+
+    bool popTask(Internal::TPTask &task) {
+        const Internal::TPWorkerInfo &info = Internal::getTPWorkerInfo();
+        const bool isWorker = info.pool == this;
+        const unsigned int first =
+            isWorker ? info.index : nextQueue.load() % queues.size();
+        for (unsigned int i = 0; i < queues.size(); ++i) {
+            Internal::TPWorkQueue &queue =
+                *queues[(first + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
             }
-            if (erased) {
-                threadStackMutexes.pop_front();
+            // The running count is raised before the queued count drops, so
+            // isQueueEmpty() and isNotRunning() never both report idle while
+            // a function is in flight.
+            runningCount.fetch_add(1);
+            queuedCount.fetch_sub(1);
+            if (isWorker && i == 0) {
+                task = queue.tasks.pop_back();
             } else {
-                break;
+                task = queue.tasks.pop_front();
             }
-        } while (!threadStacks.empty() && !threadStackMutexes.empty() &&
-                 !threadCounters.empty() && !ptrsHoldBools.empty());
+            return true;
+        }
+        return false;
     }
 
-    Internal::PointersT newStackEntry() {
-        std::lock_guard<std::mutex> lock(dequesMutex);
-        threadStacks.emplace_back();
-        threadStackMutexes.emplace_back();
-        threadCounters.emplace_back();
-        threadCounters.back().store(0);
-        ptrsHoldBools.emplace_back();
-        ptrsHoldBools.back().store(true);
-
-        return {&threadStacks.back(), &threadStackMutexes.back(),
-                &threadCounters.back(), &ptrsHoldBools.back()};
+    bool runOneTask() {
+        Internal::TPTask task;
+        if (!popTask(task)) {
+            return false;
+        }
+        // the function's batch finishes even if the function throws
+        struct Finish {
+            ThreadPool &pool;
+            TPBatch &batch;
+            ~Finish() {
+                batch.finish();
+                pool.runningCount.fetch_sub(1);
+            }
+        } finish{*this, *task.batch};
+        task.run();
+        return true;
+    }
+
+    // Like runOneTask(), but keeps the first exception thrown by a function
+    // in "error" instead of letting it escape.
+    bool runOneTask(std::exception_ptr &error) {
+        try {
+            return runOneTask();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+            return true;
+        }
+    }
+
+    void sequentiallyRunTasks() {
+        // pull functions from queue and run them on current thread, and
+        // rethrow the first exception once none are left
+        std::exception_ptr error;
+        while (runOneTask(error)) {
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
     }
 };
 
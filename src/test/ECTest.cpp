@@ -1,12 +1,15 @@
 #include "test_helpers.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <thread>
 #include <tuple>
+#include <utility>
 #include <memory>
 #include <unordered_map>
 #include <mutex>
+#include <stdexcept>
 #include <vector>
 
 #include <EC/Meta/Meta.hpp>
@@ -96,6 +99,49 @@ void setContextToThreeAndFour(std::size_t /* id */, void* context, C0* /* c */)
     contextPtr->b = 4;
 }
 
+// pseudo-random numbers for the tests applying random changes
+struct TestRandom
+{
+    explicit TestRandom(unsigned int seed) : state(seed) {}
+
+    // returns a number in [0, max)
+    unsigned int operator()(unsigned int max)
+    {
+        state = state * 1103515245 + 12345;
+        return (state >> 16) % max;
+    }
+
+    unsigned int state;
+};
+
+// returns the sorted IDs visited by forMatchingSignature() with the given
+// Signature, after calling check(id, components...) on each
+template <typename Signature, typename ManagerType, typename Check>
+std::vector<std::size_t> collectMatching(ManagerType& manager,
+                                         bool useThreadPool, Check check)
+{
+    std::vector<std::size_t> ids;
+    std::mutex mutex;
+    manager.template forMatchingSignature<Signature>(
+        [&ids, &mutex, &check] (std::size_t id, void* /* ud */,
+                                auto*... components) {
+            check(id, components...);
+            std::lock_guard<std::mutex> lock(mutex);
+            ids.push_back(id);
+        },
+        nullptr, useThreadPool);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+template <typename Signature, typename ManagerType>
+std::vector<std::size_t> collectMatching(ManagerType& manager,
+                                         bool useThreadPool)
+{
+    return collectMatching<Signature>(manager, useThreadPool,
+                                      [] (std::size_t, auto*...) {});
+}
+
 void TEST_EC_Bitset()
 {
     {
@@ -1462,3 +1508,1859 @@ void TEST_EC_NestedThreadPoolTasks() {
 
     //std::this_thread::sleep_for(std::chrono::milliseconds(100));
 }
+
+void TEST_EC_RuntimeThreadCount() {
+    using ManagerType = EC::Manager<ListComponentsAll, ListTagsAll, 1>;
+    ManagerType manager;
+    CHECK_EQ(1, manager.getThreadCount());
+
+    std::array<std::size_t, 100> entities;
+    for (auto &entity : entities) {
+        entity = manager.addEntity();
+        manager.addComponent<C0>(entity);
+    }
+
+    for (unsigned int count : {3u, 1u, 8u, 2u}) {
+        manager.setThreadCount(count);
+        CHECK_EQ(count, manager.getThreadCount());
+        manager.forMatchingSignature<EC::Meta::TypeList<C0>>(
+            [] (std::size_t /* id */, void* /* ud */, C0 *c) {
+            c->x += 1;
+        }, nullptr, true);
+        manager.forMatchingSimple<EC::Meta::TypeList<C0>>(
+            [] (std::size_t id, ManagerType *manager, void* /* ud */) {
+            manager->getEntityData<C0>(id)->y += 1;
+        }, nullptr, true);
+    }
+
+    for (const auto &entity : entities) {
+        CHECK_EQ(4, manager.getEntityData<C0>(entity)->x);
+        CHECK_EQ(4, manager.getEntityData<C0>(entity)->y);
+    }
+
+    EC::Manager<ListComponentsAll, ListTagsAll, EC::HardwareThreadCount>
+        hardwareManager;
+    const unsigned int hardwareCount = std::thread::hardware_concurrency();
+    CHECK_EQ(hardwareCount >= 2 ? hardwareCount : 1,
+             hardwareManager.getThreadCount());
+
+    // the internal ThreadPool is only created by the first parallel call
+    EC::Manager<ListComponentsAll, ListTagsAll, 3> lazyManager;
+    CHECK_EQ(3, lazyManager.getThreadCount());
+    lazyManager.addComponent<C0>(lazyManager.addEntity());
+    lazyManager.forMatchingSignature<EC::Meta::TypeList<C0>>(
+        [] (std::size_t /* id */, void* /* ud */, C0* /* c */) {});
+    CHECK_TRUE(lazyManager.getThreadPool() == nullptr);
+    lazyManager.forMatchingSignature<EC::Meta::TypeList<C0>>(
+        [] (std::size_t /* id */, void* /* ud */, C0* /* c */) {},
+        nullptr, true);
+    CHECK_TRUE(lazyManager.getThreadPool() != nullptr);
+    CHECK_EQ(3, lazyManager.getThreadPool()->getThreadCount());
+}
+
+void TEST_EC_SharedThreadPool() {
+    using ManagerType = EC::Manager<ListComponentsAll, ListTagsAll, 3>;
+    auto pool = std::make_shared<ManagerType::ThreadPoolType>();
+
+    ManagerType worldA(pool);
+    ManagerType worldB(pool);
+    CHECK_TRUE(worldA.getThreadPool() == pool);
+    CHECK_TRUE(worldB.getThreadPool() == pool);
+    CHECK_EQ(3, worldB.getThreadCount());
+
+    for (ManagerType *world : {&worldA, &worldB}) {
+        for (unsigned int i = 0; i < 200; ++i) {
+            auto id = world->addEntity();
+            world->addComponent<C0>(id);
+        }
+    }
+
+    // Both worlds use the shared pool concurrently.
+    const auto runFrames = [] (ManagerType *world) {
+        for (unsigned int frame = 0; frame < 50; ++frame) {
+            world->forMatchingSignature<EC::Meta::TypeList<C0>>(
+                [] (std::size_t /* id */, void* /* ud */, C0 *c) {
+                c->x += 1;
+            }, nullptr, true);
+        }
+    };
+    std::thread threadA(runFrames, &worldA);
+    std::thread threadB(runFrames, &worldB);
+    threadA.join();
+    threadB.join();
+
+    // Nested calls across worlds share the pool too.
+    worldA.forMatchingSignature<EC::Meta::TypeList<C0>>(
+        [] (std::size_t /* id */, void *ud, C0 *c) {
+        auto *other = static_cast<ManagerType*>(ud);
+        std::atomic_int count;
+        count.store(0);
+        other->forMatchingSignature<EC::Meta::TypeList<C0>>(
+            [] (std::size_t /* id */, void *ud, C0* /* c */) {
+            static_cast<std::atomic_int*>(ud)->fetch_add(1);
+        }, &count, true);
+        c->y = count.load();
+    }, &worldB, true);
+
+    for (ManagerType *world : {&worldA, &worldB}) {
+        world->forMatchingSignature<EC::Meta::TypeList<C0>>(
+            [] (std::size_t /* id */, void *ud, C0 *c) {
+            CHECK_EQ(50, c->x);
+            CHECK_EQ(ud == nullptr ? 200 : 0, c->y);
+        }, world == &worldA ? nullptr : world);
+    }
+
+    worldB.setThreadPool(nullptr);
+    CHECK_EQ(1, worldB.getThreadCount());
+    CHECK_EQ(3, worldA.getThreadCount());
+
+    // A shared ThreadPool without worker threads runs the functions on the
+    // threads waiting on it, which may run the functions of each other's
+    // calls, so each call must still wait for its own functions.
+    using SingleManagerType = EC::Manager<ListComponentsAll, ListTagsAll, 1>;
+    auto singlePool = std::make_shared<SingleManagerType::ThreadPoolType>();
+    SingleManagerType singleA(singlePool);
+    SingleManagerType singleB(singlePool);
+    for (SingleManagerType *world : {&singleA, &singleB}) {
+        for (unsigned int i = 0; i < 2000; ++i) {
+            world->addComponent<C0>(world->addEntity());
+        }
+    }
+    const auto runSingleFrames = [] (SingleManagerType *world) {
+        for (int frame = 1; frame <= 50; ++frame) {
+            world->forMatchingSignature<EC::Meta::TypeList<C0>>(
+                [] (std::size_t /* id */, void* /* ud */, C0 *c) {
+                std::this_thread::yield();
+                c->x += 1;
+            }, nullptr, true);
+            bool finished = true;
+            for (std::size_t id = 0; id < 2000; ++id) {
+                finished = finished &&
+                           world->getEntityData<C0>(id)->x == frame;
+            }
+            CHECK_TRUE(finished);
+        }
+    };
+    std::thread singleThreadA(runSingleFrames, &singleA);
+    std::thread singleThreadB(runSingleFrames, &singleB);
+    singleThreadA.join();
+    singleThreadB.join();
+}
+
+void TEST_EC_ParallelPartitioning() {
+    using ManagerType = EC::Manager<ListComponentsAll, ListTagsAll, 3>;
+    ManagerType manager;
+
+    // Matching entities are clustered at the end of the ID range.
+    std::array<std::size_t, 500> entities;
+    for (std::size_t i = 0; i < entities.size(); ++i) {
+        entities[i] = manager.addEntity();
+        manager.addComponent<C0>(entities[i]);
+        if (i >= 450) {
+            manager.addTag<T0>(entities[i]);
+        }
+    }
+    manager.deleteEntity(entities[460]);
+
+    auto fn = [] (std::size_t /* id */, void* /* ud */, C0 *c) {
+        c->x += 1;
+    };
+    const std::array<std::size_t, 3> tagIndices{
+        {0, 4, static_cast<std::size_t>(
+            EC::Meta::IndexOf<T0, ListCombinedComponentsTags>::value)}};
+
+    int expected = 0;
+    for (std::size_t grainSize : {0, 1, 7, 64, 10000}) {
+        for (bool splitByMatching : {false, true}) {
+            manager.setParallelGrainSize(grainSize);
+            manager.setParallelSplitByMatching(splitByMatching);
+            CHECK_EQ(grainSize, manager.getParallelGrainSize());
+            CHECK_EQ(splitByMatching, manager.isParallelSplitByMatching());
+
+            manager.forMatchingSignature<EC::Meta::TypeList<C0, T0>>(
+                fn, nullptr, true);
+            manager.forMatchingSignaturePtr<EC::Meta::TypeList<C0, T0>>(
+                &fn, nullptr, true);
+            manager.forMatchingSimple<EC::Meta::TypeList<C0, T0>>(
+                [] (std::size_t id, ManagerType *manager, void* /* ud */) {
+                manager->getEntityData<C0>(id)->x += 1;
+            }, nullptr, true);
+            manager.forMatchingIterable(tagIndices,
+                [] (std::size_t id, ManagerType *manager, void* /* ud */) {
+                manager->getEntityData<C0>(id)->x += 1;
+            }, nullptr, true);
+            expected += 4;
+        }
+    }
+
+    for (std::size_t i = 0; i < entities.size(); ++i) {
+        if (i < 450 || i == 460) {
+            CHECK_EQ(0, manager.getEntityData<C0>(entities[i])->x);
+        } else {
+            CHECK_EQ(expected, manager.getEntityData<C0>(entities[i])->x);
+        }
+    }
+}
+
+void TEST_EC_AliveSnapshot() {
+    using ManagerType = EC::Manager<ListComponentsAll, ListTagsAll, 3>;
+    ManagerType manager;
+
+    // more entities than the initial capacity, with deletions on both sides
+    // of 64-entity boundaries
+    std::vector<std::size_t> entities;
+    for (std::size_t i = 0; i < 300; ++i) {
+        entities.push_back(manager.addEntity());
+        manager.addComponent<C0>(entities.back());
+    }
+    const std::array<std::size_t, 6> deleted{{0, 63, 64, 127, 256, 299}};
+    for (std::size_t id : deleted) {
+        manager.deleteEntity(entities[id]);
+    }
+    // re-adding reuses an ID of a deleted entity
+    const std::size_t reused = manager.addEntity();
+    manager.addComponent<C0>(reused);
+    CHECK_TRUE(manager.isAlive(reused));
+
+    auto fn = [] (std::size_t /* id */, void* /* ud */, C0 *c) {
+        c->x += 1;
+    };
+    auto fnTuple = std::make_tuple(fn);
+    manager.addForMatchingFunction<EC::Meta::TypeList<C0>>(fn);
+
+    manager.forMatchingSignature<EC::Meta::TypeList<C0>>(fn, nullptr, true);
+    manager.forMatchingSignaturePtr<EC::Meta::TypeList<C0>>(
+        &fn, nullptr, true);
+    manager.forMatchingSignatures<EC::Meta::TypeList<EC::Meta::TypeList<C0>>>(
+        fnTuple, nullptr, true);
+    manager.forMatchingSignaturesPtr<
+        EC::Meta::TypeList<EC::Meta::TypeList<C0>>>(
+        std::make_tuple(&fn), nullptr, true);
+    manager.callForMatchingFunctions(true);
+
+    for (std::size_t i = 0; i < entities.size(); ++i) {
+        const int x = manager.getEntityData<C0>(entities[i])->x;
+        if (manager.isAlive(entities[i])) {
+            CHECK_EQ(5, x);
+        } else {
+            CHECK_EQ(0, x);
+        }
+    }
+    CHECK_EQ(295, manager.getCurrentSize());
+
+    manager.reset();
+    CHECK_EQ(0, manager.getCurrentSize());
+    manager.forMatchingSignature<EC::Meta::TypeList<C0>>(
+        [] (std::size_t /* id */, void* /* ud */, C0* /* c */) {
+        CHECK_TRUE(false);
+    }, nullptr, true);
+    manager.forMatchingSignature<EC::Meta::TypeList<>>(
+        [] (std::size_t /* id */, void* /* ud */) {
+        CHECK_TRUE(false);
+    }, nullptr, true);
+}
+
+// Copying throws once copiesLeft runs out, and moving is not noexcept.
+struct ThrowingCopy {
+    ThrowingCopy() { ++alive; }
+    ThrowingCopy(const ThrowingCopy& other) : value(other.value) {
+        if (copiesLeft-- <= 0) {
+            throw std::runtime_error("ThrowingCopy");
+        }
+        ++alive;
+    }
+    ThrowingCopy(ThrowingCopy&& other) : value(other.value) { ++alive; }
+    ~ThrowingCopy() { --alive; }
+
+    int value = 0;
+
+    static int copiesLeft;
+    static int alive;
+};
+int ThrowingCopy::copiesLeft = 0;
+int ThrowingCopy::alive = 0;
+
+void TEST_EC_ContiguousStorage() {
+    using ManagerType = EC::Manager<EC::Meta::TypeList<C0, C1, C0Ptr>,
+                                    ListTagsAll, 3, EC::ContiguousStorage>;
+    ManagerType manager;
+
+    // grow past the initial capacity several times
+    std::vector<std::size_t> entities;
+    for (int i = 0; i < 1000; ++i) {
+        entities.push_back(manager.addEntity());
+        manager.addComponent<C0>(entities.back(), i, i * 2);
+        manager.addComponent<C0Ptr>(entities.back(), std::make_unique<C0>(i));
+        if (i % 2 == 0) {
+            manager.addTag<T0>(entities.back());
+        }
+    }
+    CHECK_GE(manager.getCurrentCapacity(), 1000);
+
+    // components survive growth and are stored contiguously and aligned
+    for (int i = 0; i < 1000; ++i) {
+        CHECK_EQ(i, manager.getEntityData<C0>(entities[i])->x);
+        CHECK_EQ(i * 2, manager.getEntityData<C0>(entities[i])->y);
+        CHECK_EQ(i, (*manager.getEntityData<C0Ptr>(entities[i]))->x);
+    }
+    C0* first = manager.getEntityData<C0>(0);
+    CHECK_EQ(0, reinterpret_cast<std::uintptr_t>(first) % 64);
+    CHECK_EQ(first + 999, manager.getEntityData<C0>(999));
+
+    // pointers stay valid up to the reserved capacity
+    manager.reserve(2000);
+    first = manager.getEntityData<C0>(0);
+    while (manager.getCurrentSize() < 2000) {
+        manager.addEntity();
+    }
+    CHECK_EQ(first, manager.getEntityData<C0>(0));
+
+    int count = 0;
+    manager.forMatchingSignature<EC::Meta::TypeList<C0, T0>>(
+        [] (std::size_t /* id */, void* /* ud */, C0 *c) {
+        c->y = -1;
+    }, nullptr, true);
+    manager.forMatchingSignature<EC::Meta::TypeList<C0>>(
+        [&count] (std::size_t id, void* /* ud */, C0 *c) {
+        if (c->y == -1) {
+            CHECK_EQ(0, id % 2);
+            ++count;
+        }
+    });
+    CHECK_EQ(500, count);
+
+    manager.reset();
+    CHECK_EQ(0, manager.getCurrentSize());
+    std::size_t e = manager.addEntity();
+    CHECK_FALSE(manager.hasComponent<C0>(e));
+
+    // a throwing copy during growth leaves the column unchanged
+    EC::Internal::AlignedColumn<ThrowingCopy> column;
+    column.resize(4);
+    for (int i = 0; i < 4; ++i) {
+        column[i].value = i;
+    }
+    ThrowingCopy::copiesLeft = 2;
+    bool threw = false;
+    try {
+        column.reserve(16);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK_TRUE(threw);
+    CHECK_EQ(4, column.size());
+    CHECK_EQ(4, column.capacity());
+    for (int i = 0; i < 4; ++i) {
+        CHECK_EQ(i, column[i].value);
+    }
+    CHECK_EQ(4, ThrowingCopy::alive);
+
+    ThrowingCopy::copiesLeft = 4;
+    column.reserve(16);
+    CHECK_EQ(16, column.capacity());
+    CHECK_EQ(3, column[3].value);
+    CHECK_EQ(4, ThrowingCopy::alive);
+    column.clear();
+    CHECK_EQ(0, ThrowingCopy::alive);
+}
+
+struct CRare {
+    CRare(int value = 0) : value(value) {}
+
+    int value;
+};
+
+using CRarePtr = std::unique_ptr<CRare>;
+
+namespace EC {
+template <>
+struct StoragePolicy<CRare> {
+    using type = EC::SparseStoragePolicy;
+};
+template <>
+struct StoragePolicy<std::unique_ptr<CRare>> {
+    using type = EC::SparseStoragePolicy;
+};
+}
+
+template <typename StorageMode>
+static void checkSparseStoragePolicy() {
+    using ManagerType = EC::Manager<EC::Meta::TypeList<C0, CRare, CRarePtr>,
+                                    ListTagsAll, 3, StorageMode>;
+    ManagerType manager;
+
+    std::vector<std::size_t> entities;
+    for (int i = 0; i < 600; ++i) {
+        entities.push_back(manager.addEntity());
+        manager.template addComponent<C0>(entities.back(), i);
+        if (i % 100 == 0) {
+            manager.template addComponent<CRare>(entities.back(), i);
+            manager.template addComponent<CRarePtr>(entities.back(),
+                                        std::make_unique<CRare>(i));
+        }
+    }
+
+    CHECK_TRUE(manager.template getEntityData<CRare>(entities[1]) == nullptr);
+    CHECK_TRUE(manager.template getEntityData<CRare>(entities[100]) !=
+               nullptr);
+    CHECK_EQ(200,
+             manager.template getEntityData<CRare>(entities[200])->value);
+
+    // replacing keeps a single element
+    manager.template addComponent<CRare>(entities[200], 201);
+    CHECK_EQ(201,
+             manager.template getEntityData<CRare>(entities[200])->value);
+
+    // removing and deleting leaves the other elements in place
+    CRare* rare500 = manager.template getEntityData<CRare>(entities[500]);
+    manager.template removeComponent<CRare>(entities[0]);
+    manager.deleteEntity(entities[300]);
+    CHECK_TRUE(manager.template getEntityData<CRare>(entities[0]) == nullptr);
+    CHECK_TRUE(manager.template getEntityData<CRarePtr>(entities[300]) ==
+               nullptr);
+    CHECK_EQ(500,
+             manager.template getEntityData<CRare>(entities[500])->value);
+    CHECK_EQ(500,
+             (*manager.template getEntityData<CRarePtr>(entities[500]))->value);
+    CHECK_EQ(rare500, manager.template getEntityData<CRare>(entities[500]));
+
+    for (bool useThreadPool : {false, true}) {
+        int sum = 0;
+        std::mutex mutex;
+        manager.template forMatchingSignature<
+            EC::Meta::TypeList<C0, CRare, CRarePtr>>(
+            [&sum, &mutex] (std::size_t /* id */, void* /* ud */, C0 *c,
+                            CRare *rare, CRarePtr *ptr) {
+            std::lock_guard<std::mutex> lock(mutex);
+            CHECK_EQ(c->x, (*ptr)->value);
+            sum += rare->value;
+        }, nullptr, useThreadPool);
+        CHECK_EQ(100 + 201 + 400 + 500, sum);
+    }
+
+    // callbacks running in parallel add and remove sparse components of
+    // their own entity without disturbing the pointers of other callbacks
+    for (int i = 0; i < 600; ++i) {
+        manager.template addComponent<CRare>(entities[i], i);
+    }
+    manager.template forMatchingSignature<EC::Meta::TypeList<C0, CRare>>(
+        [&manager] (std::size_t id, void* /* ud */, C0 *c, CRare *rare) {
+        if (c->x % 2 == 0) {
+            manager.template removeComponent<CRare>(id);
+            manager.template addComponent<CRarePtr>(
+                id, std::make_unique<CRare>(c->x));
+        } else {
+            manager.template removeComponent<CRarePtr>(id);
+            std::this_thread::yield();
+            CHECK_EQ(c->x, rare->value);
+            rare->value = -c->x;
+        }
+    }, nullptr, true);
+    for (int i = 0; i < 600; ++i) {
+        if (i == 300) {
+            // deleted above
+            continue;
+        } else if (i % 2 == 0) {
+            CHECK_TRUE(manager.template getEntityData<CRare>(entities[i]) ==
+                       nullptr);
+            CHECK_EQ(i, (*manager.template getEntityData<CRarePtr>(
+                            entities[i]))->value);
+        } else {
+            CHECK_EQ(-i,
+                     manager.template getEntityData<CRare>(entities[i])->value);
+            CHECK_TRUE(manager.template getEntityData<CRarePtr>(
+                           entities[i]) == nullptr);
+        }
+    }
+
+    // a reused entity ID does not own the old sparse components
+    const std::size_t reused = manager.addEntity();
+    CHECK_TRUE(manager.template getEntityData<CRare>(reused) == nullptr);
+
+    manager.reset();
+    const std::size_t e = manager.addEntity();
+    CHECK_TRUE(manager.template getEntityData<CRare>(e) == nullptr);
+    CHECK_TRUE(manager.template getEntityData<C0>(e) != nullptr);
+
+    // callbacks add the sparse component to the next entity while the scan
+    // may be about to match it, so it must be stored before it is matched
+    entities.clear();
+    for (int i = 0; i < 2000; ++i) {
+        entities.push_back(manager.addEntity());
+        manager.template addComponent<C0>(entities.back(), i);
+        if (i % 2 == 0) {
+            manager.template addComponent<CRare>(entities.back(), i);
+        }
+    }
+    manager.template forMatchingSignature<EC::Meta::TypeList<C0, CRare>>(
+        [&manager, &entities] (std::size_t /* id */, void* /* ud */, C0 *c,
+                               CRare *rare) {
+        CHECK_TRUE(rare != nullptr);
+        if (rare) {
+            CHECK_EQ(c->x, rare->value);
+        }
+        if (c->x % 2 == 0 && c->x + 1 < 2000) {
+            manager.template addComponent<CRare>(entities[c->x + 1],
+                                                 c->x + 1);
+        }
+    }, nullptr, true);
+    for (int i = 0; i < 2000; ++i) {
+        CHECK_EQ(i,
+                 manager.template getEntityData<CRare>(entities[i])->value);
+    }
+}
+
+void TEST_EC_SparseStoragePolicy() {
+    checkSparseStoragePolicy<EC::DequeStorage>();
+    checkSparseStoragePolicy<EC::ContiguousStorage>();
+
+    // growing the range of IDs (as addEntity() may) while other threads
+    // use the elements of existing IDs
+    EC::Internal::SparseColumn<int> column;
+    column.resize(640);
+    std::atomic_bool growing;
+    growing.store(true);
+    std::vector<std::thread> users;
+    for (int t = 0; t < 2; ++t) {
+        users.emplace_back([&column, &growing, t] () {
+            do {
+                for (std::size_t id = t; id < 640; id += 2) {
+                    column.insert(id, static_cast<int>(id));
+                    CHECK_EQ(static_cast<int>(id), *column.find(id));
+                    if (id % 4 < 2) {
+                        column.erase(id);
+                    }
+                }
+            } while (growing.load());
+        });
+    }
+    for (std::size_t size = 640; size < 16000; size += 64) {
+        column.resize(size);
+    }
+    growing.store(false);
+    for (std::thread& user : users) {
+        user.join();
+    }
+    CHECK_EQ(16000 - 64, column.size());
+    CHECK_EQ(320, column.count());
+    for (std::size_t id = 0; id < 640; ++id) {
+        if (id % 4 < 2) {
+            CHECK_TRUE(column.find(id) == nullptr);
+        } else {
+            CHECK_EQ(static_cast<int>(id), *column.find(id));
+        }
+    }
+}
+
+void TEST_EC_ArchetypeIndex() {
+    using ManagerType = EC::Manager<ListComponentsAll, ListTagsAll, 3>;
+    ManagerType manager;
+    ManagerType reference;
+    manager.setArchetypeIndexEnabled(true);
+    CHECK_TRUE(manager.isArchetypeIndexEnabled());
+    CHECK_FALSE(reference.isArchetypeIndexEnabled());
+
+    // apply the same pseudo-random changes to both managers
+    TestRandom next(12345);
+    for (int i = 0; i < 3000; ++i) {
+        const unsigned int op = next(9);
+        const std::size_t id = next(400);
+        for (ManagerType *m : {&manager, &reference}) {
+            switch (op) {
+            case 0: m->addEntity(); break;
+            case 1: m->deleteEntity(id); break;
+            case 2: m->addComponent<C0>(id); break;
+            case 3: m->addComponent<C1>(id); break;
+            case 4: m->removeComponent<C0>(id); break;
+            case 5: m->addTag<T0>(id); break;
+            case 6: m->removeTag<T0>(id); break;
+            case 7: m->addTag<T1>(id); break;
+            default: m->removeComponent<C1>(id); break;
+            }
+        }
+        if (i == 1500) {
+            // rebuilding the index from scratch gives the same results
+            manager.setArchetypeIndexEnabled(false);
+            manager.setArchetypeIndexEnabled(true);
+        }
+    }
+
+    using Signature = EC::Meta::TypeList<C0, T0>;
+    for (bool useThreadPool : {false, true}) {
+        const std::vector<std::size_t> expected =
+            collectMatching<Signature>(reference, useThreadPool);
+        CHECK_GE(expected.size(), 1);
+        CHECK_TRUE(expected ==
+                   collectMatching<Signature>(manager, useThreadPool));
+    }
+
+    // sequential calls visit entities in order of ID
+    std::vector<std::size_t> ordered;
+    manager.forMatchingSimple<EC::Meta::TypeList<C1>>(
+        [] (std::size_t id, ManagerType* /* m */, void *ud) {
+        static_cast<std::vector<std::size_t>*>(ud)->push_back(id);
+    }, &ordered);
+    CHECK_TRUE(std::is_sorted(ordered.begin(), ordered.end()));
+    // merged from several archetypes without losing or repeating entities
+    std::vector<std::size_t> referenceOrdered;
+    reference.forMatchingSimple<EC::Meta::TypeList<C1>>(
+        [] (std::size_t id, ManagerType* /* m */, void *ud) {
+        static_cast<std::vector<std::size_t>*>(ud)->push_back(id);
+    }, &referenceOrdered);
+    CHECK_TRUE(ordered == referenceOrdered);
+
+    auto countFn = [] (std::size_t /* id */, void *ud, C0* /* c */,
+                       C1* /* c1 */) {
+        static_cast<std::atomic_int*>(ud)->fetch_add(1);
+    };
+    std::atomic_int counts[2];
+    counts[0].store(0);
+    counts[1].store(0);
+    ManagerType* managers[2] = {&reference, &manager};
+    for (int i = 0; i < 2; ++i) {
+        managers[i]->addForMatchingFunction<EC::Meta::TypeList<C0, C1>>(
+            countFn, &counts[i]);
+        managers[i]->callForMatchingFunctions(true);
+        managers[i]->forMatchingSignatures<
+            EC::Meta::TypeList<EC::Meta::TypeList<C0, C1>,
+                               EC::Meta::TypeList<C0, C1, T1>>>(
+            std::make_tuple(countFn, countFn), &counts[i]);
+        managers[i]->forMatchingIterable(std::array<int, 2>{{0, 1}},
+            [] (std::size_t /* id */, ManagerType* /* m */, void *ud) {
+            static_cast<std::atomic_int*>(ud)->fetch_add(1);
+        }, &counts[i], true);
+    }
+    CHECK_GE(counts[0].load(), 1);
+    CHECK_EQ(counts[0].load(), counts[1].load());
+
+    // callbacks running in parallel move their entities between archetypes
+    manager.clearForMatchingFunctions();
+    reference.clearForMatchingFunctions();
+    auto toggle = [] (std::size_t id, ManagerType *m, void* /* ud */) {
+        std::this_thread::yield();
+        if (m->hasTag<T1>(id)) {
+            m->removeTag<T1>(id);
+            m->addComponent<C2>(id);
+        } else {
+            m->addTag<T1>(id);
+            m->removeComponent<C2>(id);
+        }
+    };
+    for (int round = 0; round < 4; ++round) {
+        manager.forMatchingSimple<EC::Meta::TypeList<C0>>(toggle, nullptr,
+                                                         true);
+        reference.forMatchingSimple<EC::Meta::TypeList<C0>>(toggle);
+    }
+    for (bool useThreadPool : {false, true}) {
+        CHECK_TRUE(collectMatching<Signature>(reference, useThreadPool) ==
+                   collectMatching<Signature>(manager, useThreadPool));
+    }
+    using C0T1 = EC::Meta::TypeList<C0, T1>;
+    using OnlyC2 = EC::Meta::TypeList<C2>;
+    CHECK_EQ(reference.countMatching<C0T1>(), manager.countMatching<C0T1>());
+    CHECK_EQ(reference.countMatching<OnlyC2>(),
+             manager.countMatching<OnlyC2>());
+    ordered.clear();
+    manager.forMatchingSimple<EC::Meta::TypeList<C0>>(
+        [] (std::size_t id, ManagerType* /* m */, void *ud) {
+        static_cast<std::vector<std::size_t>*>(ud)->push_back(id);
+    }, &ordered);
+    CHECK_TRUE(std::is_sorted(ordered.begin(), ordered.end()));
+
+    // archetypes left without entities are removed by the next query, and
+    // the entities of the other archetypes stay indexed
+    ManagerType pruned;
+    pruned.setArchetypeIndexEnabled(true);
+    for (std::size_t i = 0; i < 16; ++i) {
+        const std::size_t id = pruned.addEntity();
+        pruned.addComponent<C0>(id);
+        if (i & 1) {
+            pruned.addComponent<C1>(id);
+        }
+        if (i & 2) {
+            pruned.addComponent<C2>(id);
+        }
+        if (i & 4) {
+            pruned.addTag<T0>(id);
+        }
+        if (i & 8) {
+            pruned.addTag<T1>(id);
+        }
+    }
+    CHECK_GE(pruned.getArchetypeCount(), 16);
+    for (std::size_t id = 0; id < 12; ++id) {
+        pruned.deleteEntity(id);
+    }
+    CHECK_EQ(4, pruned.countMatching<EC::Meta::TypeList<C0>>());
+    CHECK_TRUE(collectMatching<Signature>(pruned, false) ==
+               std::vector<std::size_t>({12, 13, 14, 15}));
+    CHECK_EQ(4, pruned.getArchetypeCount());
+    pruned.removeTag<T1>(15);
+    pruned.removeTag<T0>(13);
+    CHECK_TRUE(collectMatching<Signature>(pruned, true) ==
+               std::vector<std::size_t>({12, 14, 15}));
+}
+
+void TEST_EC_StoredFunctionCaches() {
+    using ManagerType = EC::Manager<ListComponentsAll, ListTagsAll, 3>;
+    ManagerType manager;
+
+    std::vector<std::size_t> visited;
+    int c1Count = 0;
+    auto recordFn = [] (std::size_t id, void *ud, C0* /* c */) {
+        static_cast<std::vector<std::size_t>*>(ud)->push_back(id);
+    };
+
+    for (int i = 0; i < 50; ++i) {
+        manager.addEntity();
+    }
+    // the cache is built for entities that exist when the function is added
+    manager.addComponent<C0>(3);
+    manager.addTag<T0>(3);
+    const std::size_t fnID =
+        manager.addForMatchingFunction<EC::Meta::TypeList<C0, T0>>(
+            recordFn, &visited);
+    manager.addForMatchingFunction<EC::Meta::TypeList<C1>>(
+        [] (std::size_t /* id */, void *ud, C1* /* c */) {
+        ++*static_cast<int*>(ud);
+    }, &c1Count);
+
+    // the expected matching entities, computed from scratch
+    auto expected = [&manager] () {
+        std::vector<std::size_t> ids;
+        for (std::size_t i = 0; i < manager.getCurrentCapacity(); ++i) {
+            if (manager.isAlive(i) && manager.hasComponent<C0>(i) &&
+                manager.hasTag<T0>(i)) {
+                ids.push_back(i);
+            }
+        }
+        return ids;
+    };
+
+    TestRandom next(777);
+    for (int round = 0; round < 200; ++round) {
+        for (int i = 0; i < 10; ++i) {
+            const std::size_t id = next(60);
+            switch (next(7)) {
+            case 0: manager.addEntity(); break;
+            case 1: manager.deleteEntity(id); break;
+            case 2: manager.addComponent<C0>(id); break;
+            case 3: manager.removeComponent<C0>(id); break;
+            case 4: manager.addTag<T0>(id); break;
+            case 5: manager.removeTag<T0>(id); break;
+            default: manager.addComponent<C1>(id); break;
+            }
+        }
+
+        visited.clear();
+        if (round % 2 == 0) {
+            manager.callForMatchingFunctions();
+        } else {
+            CHECK_TRUE(manager.callForMatchingFunction(fnID));
+        }
+        // sequential calls visit entities in order of ID
+        CHECK_TRUE(visited == expected());
+    }
+
+    c1Count = 0;
+    int c1Expected = 0;
+    for (std::size_t i = 0; i < manager.getCurrentCapacity(); ++i) {
+        if (manager.isAlive(i) && manager.hasComponent<C1>(i)) {
+            ++c1Expected;
+        }
+    }
+    manager.callForMatchingFunction(fnID + 1);
+    CHECK_EQ(c1Expected, c1Count);
+
+    // functions changing entities do not affect the current call
+    manager.clearForMatchingFunctions();
+    int calls = 0;
+    manager.addForMatchingFunction<EC::Meta::TypeList<C0, T0>>(
+        [&manager, &calls] (std::size_t id, void* /* ud */, C0* /* c */) {
+        ++calls;
+        manager.removeTag<T0>(id);
+        const std::size_t added = manager.addEntity();
+        manager.addComponent<C0>(added);
+        manager.addTag<T0>(added);
+    });
+    const std::size_t matchingCount = expected().size();
+    manager.callForMatchingFunctions();
+    CHECK_EQ(matchingCount, calls);
+    CHECK_EQ(matchingCount, expected().size());
+
+    // the caches stay correct when the callbacks of a parallel call change
+    // entities while a function is stored
+    manager.clearForMatchingFunctions();
+    const std::size_t storedID =
+        manager.addForMatchingFunction<EC::Meta::TypeList<C0, T0>>(
+            recordFn, &visited);
+    for (std::size_t i = 0; i < 300; ++i) {
+        manager.addComponent<C0>(manager.addEntity());
+    }
+    for (int round = 0; round < 4; ++round) {
+        manager.forMatchingSimple<EC::Meta::TypeList<C0>>(
+            [] (std::size_t id, ManagerType *m, void* /* ud */) {
+            std::this_thread::yield();
+            if (m->hasTag<T0>(id)) {
+                m->removeTag<T0>(id);
+            } else if (id % 3 != 0) {
+                m->addTag<T0>(id);
+            }
+        }, nullptr, true);
+        visited.clear();
+        CHECK_TRUE(manager.callForMatchingFunction(storedID));
+        CHECK_GE(visited.size(), 1);
+        CHECK_TRUE(visited == expected());
+    }
+}
+
+template <std::size_t N>
+struct NumberedTag {};
+
+template <typename Sequence>
+struct NumberedTags;
+
+template <std::size_t... Indices>
+struct NumberedTags<std::index_sequence<Indices...>> {
+    using type = EC::Meta::TypeList<NumberedTag<Indices>...>;
+};
+
+void TEST_EC_BitHelpers() {
+    // compare against plain loops on pseudo-random words
+    unsigned long long state = 12345;
+    auto next = [&state] () {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<std::uint64_t>(state >> 11);
+    };
+    for (int i = 0; i < 200; ++i) {
+        const std::uint64_t value = i < 64 ? std::uint64_t(1) << i
+                                           : next() | (next() << 20);
+        unsigned int trailing = 0;
+        while (((value >> trailing) & 1) == 0) {
+            ++trailing;
+        }
+        unsigned int count = 0;
+        for (unsigned int bit = 0; bit < 64; ++bit) {
+            count += (value >> bit) & 1;
+        }
+        CHECK_EQ(trailing, EC::Internal::countTrailingZeros(value));
+        CHECK_EQ(count, EC::Internal::popCount(value));
+    }
+    CHECK_EQ(0, EC::Internal::popCount(0));
+    CHECK_EQ(64, EC::Internal::popCount(~std::uint64_t(0)));
+
+    // the vector variant of andWords() picked for this CPU matches the
+    // scalar one, including counts that are not a multiple of the vector
+    // width
+    for (std::size_t count : {0, 1, 3, 4, 7, 64}) {
+        for (bool exclude : {false, true}) {
+            std::vector<std::uint64_t> in(count), vectorOut(count),
+                scalarOut(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                in[i] = next();
+                vectorOut[i] = scalarOut[i] = next();
+            }
+            EC::Internal::andWords(vectorOut.data(), in.data(), count,
+                                   exclude);
+            EC::Internal::andWordsScalar(scalarOut.data(), in.data(), count,
+                                         exclude);
+            CHECK_TRUE(vectorOut == scalarOut);
+        }
+    }
+
+    // an unknown index given to forMatchingIterable() never matches
+    {
+        EC::Manager<ListComponentsAll, ListTagsAll> manager;
+        for (int i = 0; i < 10; ++i) {
+            const std::size_t id = manager.addEntity();
+            manager.addComponent<C0>(id);
+        }
+        int count = 0;
+        auto fn = [] (std::size_t /* id */, decltype(manager)* /* m */,
+                      void* ud) {
+            ++*static_cast<int*>(ud);
+        };
+        manager.forMatchingIterable(std::vector<int>{0}, fn, &count);
+        CHECK_EQ(count, 10);
+        count = 0;
+        manager.forMatchingIterable(std::vector<int>{0, 1000}, fn, &count);
+        CHECK_EQ(count, 0);
+    }
+
+    // matching works with 64 or more Components and Tags
+    using ManyTags = NumberedTags<std::make_index_sequence<64>>::type;
+    EC::Manager<EC::Meta::TypeList<C0>, ManyTags> manager;
+    for (std::size_t i = 0; i < 100; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id));
+        if (id % 3 == 0) {
+            manager.addTag<NumberedTag<63>>(id);
+        }
+        if (id % 5 == 0) {
+            manager.addTag<NumberedTag<0>>(id);
+        }
+    }
+    manager.deleteEntity(15);
+
+    for (bool useThreadPool : {false, true}) {
+        std::vector<std::size_t> ids;
+        std::mutex mutex;
+        manager.forMatchingSignature<
+            EC::Meta::TypeList<C0, NumberedTag<0>, NumberedTag<63>>>(
+            [&ids, &mutex] (std::size_t id, void* /* ud */, C0* c) {
+                CHECK_EQ(static_cast<std::size_t>(c->x), id);
+                std::lock_guard<std::mutex> lock(mutex);
+                ids.push_back(id);
+            },
+            nullptr, useThreadPool);
+        std::sort(ids.begin(), ids.end());
+        CHECK_TRUE(ids == std::vector<std::size_t>({0, 30, 45, 60, 75, 90}));
+    }
+}
+
+void TEST_EC_Bitplanes() {
+    // signatures with few and many bits are both scanned with the
+    // bitplanes
+    using SomeTags = NumberedTags<std::make_index_sequence<20>>::type;
+    using FewBits = EC::Meta::TypeList<C0, NumberedTag<3>>;
+    using ManyBits = EC::Meta::TypeList<
+        C0, NumberedTag<0>, NumberedTag<1>, NumberedTag<2>, NumberedTag<3>,
+        NumberedTag<4>, NumberedTag<5>, NumberedTag<6>, NumberedTag<7>,
+        NumberedTag<8>, NumberedTag<9>, NumberedTag<10>, NumberedTag<11>,
+        NumberedTag<12>, NumberedTag<13>, NumberedTag<14>, NumberedTag<15>>;
+    using TestManager = EC::Manager<EC::Meta::TypeList<C0>, SomeTags>;
+    TestManager manager;
+
+    auto setTags = [&manager] (std::size_t id, bool value) {
+        EC::Meta::forEach<SomeTags>([&manager, id, value] (auto tag) {
+            if (value) {
+                manager.addTag<decltype(tag)>(id);
+            } else {
+                manager.removeTag<decltype(tag)>(id);
+            }
+        });
+    };
+    auto expected = [&manager] (bool allTags) {
+        std::vector<std::size_t> ids;
+        for (std::size_t i = 0; i < manager.getCurrentCapacity(); ++i) {
+            if (manager.isAlive(i) && manager.hasComponent<C0>(i) &&
+                    manager.hasTag<NumberedTag<3>>(i) &&
+                    (!allTags || manager.hasTag<NumberedTag<15>>(i))) {
+                ids.push_back(i);
+            }
+        }
+        return ids;
+    };
+
+    // more entities than fit in one block of bitplanes
+    TestRandom next(4242);
+    for (int i = 0; i < 6000; ++i) {
+        manager.addEntity();
+    }
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 2000; ++i) {
+            const std::size_t id = next(6000);
+            switch (next(6)) {
+            case 0: manager.deleteEntity(id); break;
+            case 1: manager.addEntity(); break;
+            case 2: manager.addComponent<C0>(id); break;
+            case 3: manager.removeComponent<C0>(id); break;
+            case 4: setTags(id, true); break;
+            default: manager.removeTag<NumberedTag<3>>(id); break;
+            }
+        }
+        for (bool useThreadPool : {false, true}) {
+            CHECK_TRUE(collectMatching<FewBits>(manager, useThreadPool) ==
+                       expected(false));
+            CHECK_TRUE(collectMatching<ManyBits>(manager, useThreadPool) ==
+                       expected(true));
+        }
+    }
+
+    // entities changed by the function before they are reached are skipped
+    for (std::size_t i = 0; i < 200; ++i) {
+        if (manager.isAlive(i)) {
+            manager.addComponent<C0>(i);
+            setTags(i, true);
+        }
+    }
+    std::vector<std::size_t> visited;
+    manager.forMatchingSignature<FewBits>(
+        [&manager, &visited] (std::size_t id, void* /* ud */, C0* /* c */) {
+            visited.push_back(id);
+            if (manager.isAlive(id + 1)) {
+                manager.removeTag<NumberedTag<3>>(id + 1);
+            }
+        });
+    for (std::size_t i = 1; i < visited.size(); ++i) {
+        CHECK_GE(visited[i], visited[i - 1] + 2);
+    }
+
+    // reset() clears the bits of the removed entities
+    manager.reset();
+    const std::size_t id = manager.addEntity();
+    std::size_t count = 0;
+    manager.forMatchingSignature<EC::Meta::TypeList<C0>>(
+        [&count] (std::size_t, void*, C0*) { ++count; });
+    CHECK_EQ(count, 0);
+    manager.addComponent<C0>(id);
+    manager.forMatchingSignature<EC::Meta::TypeList<C0>>(
+        [&count] (std::size_t, void*, C0*) { ++count; });
+    CHECK_EQ(count, 1);
+}
+
+void TEST_EC_SummaryBitmaps() {
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    for (std::size_t i = 0; i < 20000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id));
+        if (id % 2 == 0) {
+            manager.addTag<T0>(id);
+        }
+    }
+
+    // mass despawn, keeping entities around block and word boundaries
+    const std::vector<std::size_t> kept{0, 63, 64, 4095, 4096, 4160, 8191,
+                                        12000, 19999};
+    for (std::size_t i = 0; i < 20000; ++i) {
+        if (std::find(kept.begin(), kept.end(), i) == kept.end()) {
+            manager.deleteEntity(i);
+        }
+    }
+
+    auto found = [&manager] (bool tagged, bool useThreadPool) {
+        auto check = [] (std::size_t id, C0* c) {
+            CHECK_EQ(static_cast<std::size_t>(c->x), id);
+        };
+        return tagged ? collectMatching<EC::Meta::TypeList<C0, T0>>(
+                            manager, useThreadPool, check)
+                      : collectMatching<EC::Meta::TypeList<C0>>(
+                            manager, useThreadPool, check);
+    };
+    for (bool useThreadPool : {false, true}) {
+        CHECK_TRUE(found(false, useThreadPool) == kept);
+        CHECK_TRUE(found(true, useThreadPool) ==
+                   std::vector<std::size_t>({0, 64, 4096, 4160, 12000}));
+    }
+
+    // removing the last bit of a word or block and adding it back
+    manager.removeComponent<C0>(4095);
+    manager.removeComponent<C0>(4096);
+    CHECK_TRUE(found(false, false) ==
+               std::vector<std::size_t>({0, 63, 64, 4160, 8191, 12000,
+                                         19999}));
+    manager.addComponent<C0>(4096, 4096);
+    manager.deleteEntity(19999);
+    CHECK_TRUE(found(false, false) ==
+               std::vector<std::size_t>({0, 63, 64, 4096, 4160, 8191, 12000}));
+    const std::size_t added = manager.addEntity();
+    manager.addComponent<C0>(added, static_cast<int>(added));
+    CHECK_TRUE(found(false, true).size() == 8);
+}
+
+void TEST_EC_SignatureFilters() {
+    using Filtered = EC::Meta::TypeList<C0, EC::Without<T0>, EC::Optional<C1>>;
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    std::vector<std::size_t> expected;
+    for (std::size_t i = 0; i < 100; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id));
+        if (id % 2 == 1) {
+            manager.addComponent<C1>(id);
+        }
+        if (id % 3 == 0) {
+            manager.addTag<T0>(id);
+        } else {
+            expected.push_back(id);
+        }
+    }
+
+    auto found = [&manager] (bool useThreadPool) {
+        return collectMatching<Filtered>(
+            manager, useThreadPool, [] (std::size_t id, C0* c0, C1* c1) {
+                CHECK_EQ(static_cast<std::size_t>(c0->x), id);
+                CHECK_EQ(c1 != nullptr, id % 2 == 1);
+            });
+    };
+    for (bool archetypeIndex : {false, true}) {
+        manager.setArchetypeIndexEnabled(archetypeIndex);
+        CHECK_TRUE(found(false) == expected);
+        CHECK_TRUE(found(true) == expected);
+    }
+    manager.setArchetypeIndexEnabled(false);
+
+    int count = 0;
+    manager.forMatchingSimple<EC::Meta::TypeList<C0, EC::Without<T0>>>(
+        [] (std::size_t /* id */, decltype(manager)* /* m */, void* ud) {
+            ++*static_cast<int*>(ud);
+        },
+        &count);
+    CHECK_EQ(count, static_cast<int>(expected.size()));
+
+    // filters on types unknown to the Manager are ignored
+    count = 0;
+    manager.forMatchingSignature<
+        EC::Meta::TypeList<C0, EC::Without<NumberedTag<0>>,
+                           EC::Optional<NumberedTag<1>>>>(
+        [&count] (std::size_t /* id */, void* /* ud */, C0* /* c */) {
+            ++count;
+        });
+    CHECK_EQ(count, 100);
+
+    // stored functions follow changes to excluded Tags
+    std::vector<std::size_t> visited;
+    const std::size_t fnID = manager.addForMatchingFunction<Filtered>(
+        [&visited] (std::size_t id, void* /* ud */, C0* /* c0 */, C1* c1) {
+            CHECK_EQ(c1 != nullptr, id % 2 == 1);
+            visited.push_back(id);
+        });
+    manager.addTag<T0>(1);
+    manager.removeTag<T0>(3);
+    expected.erase(expected.begin());
+    expected.insert(expected.begin() + 1, 3);
+    CHECK_TRUE(manager.callForMatchingFunction(fnID));
+    CHECK_TRUE(visited == expected);
+
+    std::size_t withoutCount = 0;
+    std::size_t optionalCount = 0;
+    manager.forMatchingSignatures<EC::Meta::TypeList<
+        EC::Meta::TypeList<EC::Without<C0>>, Filtered>>(
+        std::make_tuple(
+            [&withoutCount] (std::size_t /* id */, void* /* ud */) {
+                ++withoutCount;
+            },
+            [&optionalCount] (std::size_t /* id */, void* /* ud */,
+                              C0* /* c0 */, C1* c1) {
+                if (c1) {
+                    ++optionalCount;
+                }
+            }));
+    CHECK_EQ(withoutCount, 0);
+    CHECK_EQ(optionalCount, 33);
+
+    // exclusion with a signature scanned through the match masks
+    using SomeTags = NumberedTags<std::make_index_sequence<20>>::type;
+    EC::Manager<EC::Meta::TypeList<C0>, SomeTags> tagged;
+    for (std::size_t i = 0; i < 10; ++i) {
+        const std::size_t id = tagged.addEntity();
+        EC::Meta::forEach<SomeTags>([&tagged, id] (auto tag) {
+            tagged.addTag<decltype(tag)>(id);
+        });
+        if (id % 2 == 0) {
+            tagged.removeTag<NumberedTag<19>>(id);
+        }
+    }
+    count = 0;
+    tagged.forMatchingSignature<EC::Meta::TypeList<
+        NumberedTag<0>, NumberedTag<1>, NumberedTag<2>, NumberedTag<3>,
+        NumberedTag<4>, NumberedTag<5>, NumberedTag<6>, NumberedTag<7>,
+        NumberedTag<8>, NumberedTag<9>, NumberedTag<10>, NumberedTag<11>,
+        NumberedTag<12>, NumberedTag<13>, NumberedTag<14>, NumberedTag<15>,
+        NumberedTag<16>, EC::Without<NumberedTag<19>>>>(
+        [&count] (std::size_t id, void* /* ud */) {
+            CHECK_EQ(id % 2, 0);
+            ++count;
+        });
+    CHECK_EQ(count, 5);
+
+    // a signature that requires and excludes the same Component matches
+    // nothing on every path
+    using Contradiction = EC::Meta::TypeList<C0, EC::Without<C0>>;
+    std::atomic_int matched;
+    matched.store(0);
+    auto onMatch = [&matched] (std::size_t /* id */, void* /* ud */,
+                               C0* /* c0 */) {
+        matched.fetch_add(1);
+    };
+    for (bool archetypeIndex : {false, true}) {
+        manager.setArchetypeIndexEnabled(archetypeIndex);
+        for (bool splitByMatching : {false, true}) {
+            manager.setParallelSplitByMatching(splitByMatching);
+            for (bool useThreadPool : {false, true}) {
+                manager.forMatchingSignature<Contradiction>(
+                    onMatch, nullptr, useThreadPool);
+                manager.forMatchingSignaturePtr<Contradiction>(
+                    &onMatch, nullptr, useThreadPool);
+                manager.forMatchingSimple<Contradiction>(
+                    [] (std::size_t /* id */, decltype(manager)* /* m */,
+                        void* ud) {
+                        static_cast<std::atomic_int*>(ud)->fetch_add(1);
+                    },
+                    &matched, useThreadPool);
+                manager.forMatchingChunks<Contradiction>(
+                    [&matched] (const std::size_t* /* ids */,
+                                std::size_t count, void* /* ud */,
+                                C0* /* c0 */) {
+                        matched.fetch_add(static_cast<int>(count));
+                    },
+                    nullptr, useThreadPool);
+                // shares the scan of TypeList<C0> in the query plan
+                manager.forMatchingSignatures<EC::Meta::TypeList<
+                    EC::Meta::TypeList<C0>, Contradiction>>(
+                    std::make_tuple(
+                        [] (std::size_t /* id */, void* /* ud */,
+                            C0* /* c0 */) {},
+                        onMatch),
+                    nullptr, useThreadPool);
+                manager.forMatchingSignaturesFused<
+                    EC::Meta::TypeList<Contradiction>>(
+                    std::make_tuple(onMatch), nullptr, useThreadPool);
+                CHECK_EQ(manager.countMatching<Contradiction>(useThreadPool),
+                         0);
+                CHECK_FALSE(manager.anyMatching<Contradiction>(
+                    useThreadPool));
+                std::size_t first = 0;
+                CHECK_FALSE(manager.firstMatching<Contradiction>(
+                    first, useThreadPool));
+                CHECK_EQ(manager.forMatchingReduce<Contradiction>(
+                             0,
+                             [] (std::size_t /* id */, C0* /* c0 */) {
+                                 return 1;
+                             },
+                             [] (int a, int b) { return a + b; },
+                             useThreadPool),
+                         0);
+            }
+        }
+        for (auto entity : manager.view<Contradiction>()) {
+            (void)entity;
+            matched.fetch_add(1);
+        }
+        const std::size_t storedID =
+            manager.addForMatchingFunction<Contradiction>(onMatch);
+        CHECK_TRUE(manager.callForMatchingFunction(storedID));
+        CHECK_TRUE(manager.callForMatchingFunction(storedID, true));
+        manager.removeForMatchingFunction(storedID);
+    }
+    manager.setArchetypeIndexEnabled(false);
+    manager.setParallelSplitByMatching(false);
+    CHECK_EQ(matched.load(), 0);
+}
+
+template <typename StorageMode>
+static void checkForMatchingChunks() {
+    using ChunkManager = EC::Manager<EC::Meta::TypeList<C0, C1, CRare>,
+                                     ListTagsAll, 4, StorageMode>;
+    ChunkManager manager;
+    for (std::size_t i = 0; i < 1000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.template addComponent<C0>(id, static_cast<int>(id));
+        if (id % 7 != 3) {
+            manager.template addComponent<C1>(id);
+        }
+        if (id % 5 == 0) {
+            manager.template addComponent<CRare>(id, static_cast<int>(id));
+        }
+        if (id % 100 == 50) {
+            manager.template addTag<T0>(id);
+        }
+    }
+
+    auto expected = [&manager] (bool rare) {
+        std::vector<std::size_t> ids;
+        for (std::size_t i = 0; i < manager.getCurrentCapacity(); ++i) {
+            if (manager.isAlive(i) &&
+                    manager.template hasComponent<C1>(i) &&
+                    !manager.template hasTag<T0>(i) &&
+                    (!rare || manager.template hasComponent<CRare>(i))) {
+                ids.push_back(i);
+            }
+        }
+        return ids;
+    };
+
+    using Signature = EC::Meta::TypeList<C0, C1, EC::Without<T0>>;
+    int round = 0;
+    for (bool archetypeIndex : {false, true}) {
+        manager.setArchetypeIndexEnabled(archetypeIndex);
+        for (bool useThreadPool : {false, true}) {
+            ++round;
+            std::vector<std::size_t> visited;
+            std::mutex mutex;
+            manager.template forMatchingChunks<Signature>(
+                [&manager, &visited, &mutex, round] (const std::size_t* ids,
+                        std::size_t count, void* /* ud */, C0* c0, C1* c1) {
+                    CHECK_TRUE(count > 0 && count <= EC_CHUNK_SIZE);
+                    if (std::is_same<StorageMode,
+                                     EC::ContiguousStorage>::value) {
+                        CHECK_TRUE(
+                            c0 == manager.template getEntityData<C0>(ids[0]));
+                        CHECK_EQ(ids[count - 1] - ids[0] + 1, count);
+                    }
+                    for (std::size_t i = 0; i < count; ++i) {
+                        CHECK_EQ(static_cast<std::size_t>(c0[i].x), ids[i]);
+                        c0[i].y = round;
+                        c1[i].vx = static_cast<int>(ids[i]);
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    visited.insert(visited.end(), ids, ids + count);
+                },
+                nullptr, useThreadPool);
+            std::sort(visited.begin(), visited.end());
+            CHECK_TRUE(visited == expected(false));
+            for (std::size_t id : visited) {
+                CHECK_EQ(manager.template getEntityData<C0>(id)->y, round);
+                CHECK_EQ(manager.template getEntityData<C1>(id)->vx,
+                         static_cast<int>(id));
+            }
+        }
+    }
+    manager.setArchetypeIndexEnabled(false);
+
+    // sparse Components are always gathered
+    std::vector<std::size_t> visited;
+    manager.template forMatchingChunks<
+        EC::Meta::TypeList<CRare, C1, EC::Without<T0>>>(
+        [&visited] (const std::size_t* ids, std::size_t count,
+                    void* /* ud */, CRare* rare, C1* /* c1 */) {
+            for (std::size_t i = 0; i < count; ++i) {
+                CHECK_EQ(static_cast<std::size_t>(rare[i].value), ids[i]);
+                rare[i].value = -1;
+            }
+            visited.insert(visited.end(), ids, ids + count);
+        });
+    CHECK_TRUE(visited == expected(true));
+    for (std::size_t id : visited) {
+        CHECK_EQ(manager.template getEntityData<CRare>(id)->value, -1);
+    }
+}
+
+void TEST_EC_ForMatchingChunks() {
+    checkForMatchingChunks<EC::DequeStorage>();
+    checkForMatchingChunks<EC::ContiguousStorage>();
+}
+
+void TEST_EC_View() {
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    CHECK_TRUE(manager.view<EC::Meta::TypeList<C0>>().begin() ==
+               manager.view<EC::Meta::TypeList<C0>>().end());
+
+    for (std::size_t i = 0; i < 5000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id));
+        if (id % 3 != 0) {
+            manager.addComponent<C1>(id);
+        }
+        if (id % 10 == 0) {
+            manager.addTag<T0>(id);
+        }
+    }
+    for (std::size_t id = 0; id < 5000; id += 7) {
+        manager.deleteEntity(id);
+    }
+
+    auto expected = [&manager] () {
+        std::vector<std::size_t> ids;
+        for (std::size_t i = 0; i < manager.getCurrentCapacity(); ++i) {
+            if (manager.isAlive(i) && manager.hasComponent<C0>(i) &&
+                    manager.hasComponent<C1>(i) && !manager.hasTag<T0>(i)) {
+                ids.push_back(i);
+            }
+        }
+        return ids;
+    };
+
+    using Signature = EC::Meta::TypeList<C0, C1, EC::Without<T0>>;
+    std::vector<std::size_t> visited;
+    for (auto entity : manager.view<Signature>()) {
+        const std::size_t id = std::get<0>(entity);
+        C0& c0 = std::get<1>(entity);
+        CHECK_EQ(static_cast<std::size_t>(c0.x), id);
+        c0.y = 5;
+        std::get<2>(entity).vx = 6;
+        visited.push_back(id);
+    }
+    CHECK_TRUE(visited == expected());
+    for (std::size_t id : visited) {
+        CHECK_EQ(manager.getEntityData<C0>(id)->y, 5);
+        CHECK_EQ(manager.getEntityData<C1>(id)->vx, 6);
+    }
+
+    // optional Components are given as pointers
+    std::size_t count = 0;
+    for (auto entity : manager.view<
+             EC::Meta::TypeList<C0, EC::Optional<C1>>>()) {
+        CHECK_EQ(std::get<2>(entity) != nullptr,
+                 manager.hasComponent<C1>(std::get<0>(entity)));
+        ++count;
+    }
+    CHECK_EQ(count, manager.getCurrentSize());
+
+    // split views cover the whole range in parallel
+    auto views = manager.view<Signature>().split(4);
+    CHECK_EQ(views.size(), 4);
+    CHECK_EQ(views.front().getRange()[0], 0);
+    CHECK_EQ(views.back().getRange()[1], 5000);
+    std::vector<std::vector<std::size_t>> parts(views.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < views.size(); ++i) {
+        CHECK_TRUE(i == 0 ||
+                   views[i].getRange()[0] == views[i - 1].getRange()[1]);
+        threads.emplace_back([&views, &parts, i] () {
+            for (auto entity : views[i]) {
+                parts[i].push_back(std::get<0>(entity));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    visited.clear();
+    for (const auto& part : parts) {
+        visited.insert(visited.end(), part.begin(), part.end());
+    }
+    CHECK_TRUE(visited == expected());
+
+    // entities changed or deleted during iteration are skipped
+    visited.clear();
+    for (auto entity : manager.view<Signature>()) {
+        const std::size_t id = std::get<0>(entity);
+        visited.push_back(id);
+        manager.removeComponent<C1>(id + 1);
+        manager.deleteEntity(id + 2);
+    }
+    for (std::size_t i = 1; i < visited.size(); ++i) {
+        CHECK_GE(visited[i], visited[i - 1] + 3);
+    }
+    CHECK_TRUE(expected().size() == visited.size());
+
+    // a signature scanned through the match masks
+    using SomeTags = NumberedTags<std::make_index_sequence<20>>::type;
+    EC::Manager<EC::Meta::TypeList<C0>, SomeTags> tagged;
+    for (std::size_t i = 0; i < 200; ++i) {
+        const std::size_t id = tagged.addEntity();
+        if (id % 3 == 0) {
+            EC::Meta::forEach<SomeTags>([&tagged, id] (auto tag) {
+                tagged.addTag<decltype(tag)>(id);
+            });
+        }
+    }
+    count = 0;
+    for (auto entity : tagged.view<EC::Meta::TypeList<
+             NumberedTag<0>, NumberedTag<1>, NumberedTag<2>, NumberedTag<3>,
+             NumberedTag<4>, NumberedTag<5>, NumberedTag<6>, NumberedTag<7>,
+             NumberedTag<8>, NumberedTag<9>, NumberedTag<10>, NumberedTag<11>,
+             NumberedTag<12>, NumberedTag<13>, NumberedTag<14>, NumberedTag<15>,
+             NumberedTag<16>>>()) {
+        CHECK_EQ(std::get<0>(entity) % 3, 0);
+        ++count;
+    }
+    CHECK_EQ(count, 67);
+}
+
+void TEST_EC_OrderedParallelMatching() {
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    for (std::size_t i = 0; i < 3000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id));
+        if (id % 4 != 0) {
+            manager.addTag<T0>(id);
+        }
+    }
+    manager.setParallelGrainSize(100);
+    manager.setParallelSplitByMatching(true);
+
+    // matching entities gathered in parallel are split in order of ID, so
+    // every chunk has increasing IDs
+    for (int round = 0; round < 10; ++round) {
+        std::vector<std::size_t> visited;
+        std::mutex mutex;
+        manager.forMatchingChunks<EC::Meta::TypeList<C0, T0>>(
+            [&visited, &mutex] (const std::size_t* ids, std::size_t count,
+                                void* /* ud */, C0* c0) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    CHECK_EQ(static_cast<std::size_t>(c0[i].x), ids[i]);
+                    CHECK_TRUE(i == 0 || ids[i - 1] < ids[i]);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                visited.insert(visited.end(), ids, ids + count);
+            },
+            nullptr, true);
+        CHECK_EQ(visited.size(), 2250);
+    }
+}
+
+void TEST_EC_MatchPlan() {
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    for (std::size_t i = 0; i < 5000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id));
+        if (id % 2 == 0) {
+            manager.addComponent<C1>(id);
+        }
+        if (id % 3 == 0) {
+            manager.addTag<T0>(id);
+        }
+        if (id % 5 == 0) {
+            manager.addTag<T1>(id);
+        }
+    }
+    for (std::size_t id = 0; id < 5000; id += 7) {
+        manager.deleteEntity(id);
+    }
+
+    // overlapping signatures, and duplicates (the unknown Base is ignored)
+    using SigList = EC::Meta::TypeList<
+        EC::Meta::TypeList<C0, C1, T0>,
+        EC::Meta::TypeList<C0>,
+        EC::Meta::TypeList<C0, C1, EC::Without<T1>>,
+        EC::Meta::TypeList<C0, C1>,
+        EC::Meta::TypeList<C0, EC::Without<T1>>,
+        EC::Meta::TypeList<C1, C0>,
+        EC::Meta::TypeList<C0, Base>>;
+
+    std::vector<std::vector<std::size_t>> expected(SigList::size);
+    EC::Meta::forEachWithIndex<SigList>(
+        [&manager, &expected] (auto signature, const auto index) {
+            std::vector<std::size_t>& matching = expected[index];
+            manager.template forMatchingSignature<decltype(signature)>(
+                [&matching] (std::size_t id, void* /* ud */,
+                             auto... /* components */) {
+                    matching.push_back(id);
+                });
+        });
+    CHECK_EQ(expected[0].size(), 714);
+    CHECK_TRUE(expected[3] == expected[5]);
+    CHECK_TRUE(expected[6] == expected[1]);
+
+    for (int threaded = 0; threaded < 2; ++threaded) {
+        std::vector<std::vector<std::size_t>> found(SigList::size);
+        std::mutex mutex;
+        const auto collect = [&found, &mutex] (std::size_t index,
+                                               std::size_t id) {
+            std::lock_guard<std::mutex> lock(mutex);
+            found[index].push_back(id);
+        };
+        manager.forMatchingSignatures<SigList>(
+            std::make_tuple(
+                [&collect] (std::size_t id, void*, C0*, C1*) {
+                    collect(0, id);
+                },
+                [&collect] (std::size_t id, void*, C0*) {
+                    collect(1, id);
+                },
+                [&collect] (std::size_t id, void*, C0*, C1*) {
+                    collect(2, id);
+                },
+                [&collect] (std::size_t id, void*, C0*, C1*) {
+                    collect(3, id);
+                },
+                [&collect] (std::size_t id, void*, C0*) {
+                    collect(4, id);
+                },
+                [&collect] (std::size_t id, void*, C1*, C0*) {
+                    collect(5, id);
+                },
+                [&collect] (std::size_t id, void*, C0*) {
+                    collect(6, id);
+                }),
+            nullptr, threaded != 0);
+        for (std::size_t i = 0; i < SigList::size; ++i) {
+            std::sort(found[i].begin(), found[i].end());
+            CHECK_TRUE(found[i] == expected[i]);
+        }
+    }
+}
+
+void TEST_EC_FusedSignatures() {
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    for (std::size_t i = 0; i < 3000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id));
+        if (id % 2 == 0) {
+            manager.addComponent<C1>(id);
+        }
+        if (id % 3 == 0) {
+            manager.addTag<T0>(id);
+        }
+    }
+
+    using SigList = EC::Meta::TypeList<
+        EC::Meta::TypeList<C0>,
+        EC::Meta::TypeList<C0, C1>,
+        EC::Meta::TypeList<C0, T0>>;
+
+    // all functions run on an entity before the next entity
+    std::vector<std::array<std::size_t, 2>> calls;
+    manager.forMatchingSignaturesFused<SigList>(
+        std::make_tuple(
+            [&calls] (std::size_t id, void*, C0* c0) {
+                calls.push_back({id, 0});
+                ++c0->y;
+            },
+            [&calls, &manager] (std::size_t id, void*, C0* c0, C1*) {
+                calls.push_back({id, 1});
+                CHECK_EQ(c0->y, 1);
+                if (id % 4 == 0) {
+                    manager.removeTag<T0>(id);
+                }
+            },
+            [&calls] (std::size_t id, void*, C0*) {
+                calls.push_back({id, 2});
+            }));
+    CHECK_EQ(calls.size(), 3000 + 1500 + 1000 - 250);
+    CHECK_TRUE(std::is_sorted(calls.begin(), calls.end()));
+    for (const auto& call : calls) {
+        // removing T0 skips the last function
+        CHECK_FALSE(call[1] == 2 && call[0] % 12 == 0);
+    }
+
+    std::atomic_uint count(0);
+    std::atomic_uint wrong(0);
+    manager.forMatchingSignaturesFused<SigList>(
+        std::make_tuple(
+            [&count] (std::size_t, void*, C0* c0) {
+                ++count;
+                ++c0->y;
+            },
+            [&count, &wrong] (std::size_t, void*, C0* c0, C1*) {
+                ++count;
+                if (c0->y != 2) {
+                    ++wrong;
+                }
+            },
+            [&count] (std::size_t, void*, C0*) {
+                ++count;
+            }),
+        nullptr, true);
+    CHECK_EQ(count.load(), 3000 + 1500 + 1000 - 250);
+    CHECK_EQ(wrong.load(), 0);
+}
+
+void TEST_EC_QueryMatching() {
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    manager.setThreadCount(4);
+    for (std::size_t i = 0; i < 5000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id);
+        if (id % 2 == 0) {
+            manager.addComponent<C1>(id);
+        }
+        if (id % 3 == 0) {
+            manager.addTag<T0>(id);
+        }
+    }
+    for (std::size_t id = 0; id < 5000; id += 5) {
+        manager.deleteEntity(id);
+    }
+
+    using C0C1T0 = EC::Meta::TypeList<C0, C1, T0>;
+    using C0NoT0 = EC::Meta::TypeList<C0, EC::Without<T0>>;
+    using C2T1 = EC::Meta::TypeList<C2, T1>;
+    for (int indexed = 0; indexed < 2; ++indexed) {
+        manager.setArchetypeIndexEnabled(indexed != 0);
+        for (int threaded = 0; threaded < 2; ++threaded) {
+            CHECK_EQ(manager.countMatching<C0C1T0>(threaded != 0), 667);
+            CHECK_EQ(manager.countMatching<C0NoT0>(threaded != 0), 2667);
+            CHECK_EQ(manager.countMatching<C2T1>(threaded != 0), 0);
+            CHECK_EQ(manager.countMatching<EC::Meta::TypeList<C0>>(
+                         threaded != 0),
+                     4000);
+        }
+        for (int threaded = 0; threaded < 2; ++threaded) {
+            CHECK_TRUE(manager.anyMatching<C0C1T0>(threaded != 0));
+            CHECK_FALSE(manager.anyMatching<C2T1>(threaded != 0));
+
+            std::size_t id = 0;
+            CHECK_TRUE(manager.firstMatching<C0C1T0>(id, threaded != 0));
+            CHECK_EQ(id, 6);
+            CHECK_FALSE(manager.firstMatching<C2T1>(id, threaded != 0));
+            CHECK_EQ(id, 6);
+        }
+    }
+
+    // matches in several sections, the lowest of them in a later section
+    manager.setArchetypeIndexEnabled(false);
+    manager.addComponent<C2>(4999);
+    manager.addTag<T1>(4999);
+    manager.addComponent<C2>(3001);
+    manager.addTag<T1>(3001);
+    for (int threaded = 0; threaded < 2; ++threaded) {
+        CHECK_TRUE(manager.anyMatching<C2T1>(threaded != 0));
+        std::size_t id = 0;
+        CHECK_TRUE(manager.firstMatching<C2T1>(id, threaded != 0));
+        CHECK_EQ(id, 3001);
+    }
+    manager.removeComponent<C2>(3001);
+    manager.removeComponent<C2>(4999);
+
+    std::size_t counted = 0;
+    manager.forMatchingSignature<C0C1T0>(
+        [&counted] (std::size_t, void*, C0*, C1*) { ++counted; });
+    CHECK_EQ(counted, 667);
+}
+
+void TEST_EC_ForMatchingReduce() {
+    EC::Manager<ListComponentsAll, ListTagsAll> manager;
+    manager.setThreadCount(4);
+    for (std::size_t i = 0; i < 5000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<C0>(id, static_cast<int>(id), 1);
+        if (id % 3 == 0) {
+            manager.addTag<T0>(id);
+        }
+    }
+    for (std::size_t id = 0; id < 5000; id += 4) {
+        manager.deleteEntity(id);
+    }
+
+    long long expectedSum = 0;
+    for (std::size_t id = 0; id < 5000; ++id) {
+        if (id % 4 != 0 && id % 3 == 0) {
+            expectedSum += static_cast<long long>(id);
+        }
+    }
+
+    using Signature = EC::Meta::TypeList<C0, T0>;
+    const auto mapFn = [] (std::size_t, C0* c0) {
+        return static_cast<long long>(c0->x);
+    };
+    const auto sumFn = [] (long long a, long long b) { return a + b; };
+    // a non-commutative combine shows the values are combined in order
+    const auto orderFn = [] (std::vector<std::size_t> a,
+                             std::vector<std::size_t> b) {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+    };
+    const auto idFn = [] (std::size_t id, C0*) {
+        return std::vector<std::size_t>{id};
+    };
+
+    for (int mode = 0; mode < 3; ++mode) {
+        manager.setArchetypeIndexEnabled(mode == 2);
+        manager.setParallelSplitByMatching(mode == 1);
+        for (int threaded = 0; threaded < 2; ++threaded) {
+            CHECK_EQ(manager.forMatchingReduce<Signature>(
+                         10LL, mapFn, sumFn, threaded != 0),
+                     expectedSum + 10);
+
+            const std::vector<std::size_t> ids =
+                manager.forMatchingReduce<Signature>(
+                    std::vector<std::size_t>{}, idFn, orderFn,
+                    threaded != 0);
+            CHECK_EQ(ids.size(), 1250);
+            CHECK_TRUE(std::is_sorted(ids.begin(), ids.end()));
+        }
+    }
+
+    // nothing matches
+    CHECK_EQ(manager.forMatchingReduce<EC::Meta::TypeList<C1>>(
+                 7, [] (std::size_t, C1*) { return 1; },
+                 [] (int a, int b) { return a + b; }, true),
+             7);
+}
+
+// Components whose changes are tracked, alongside C0 and C1 whose changes
+// are not
+struct TrackedC0 : C0 {
+    using C0::C0;
+};
+struct TrackedC1 : C1 {};
+
+namespace EC {
+template <>
+struct TrackChanges<TrackedC0> : std::true_type {};
+template <>
+struct TrackChanges<TrackedC1> : std::true_type {};
+}
+
+using ListComponentsTracked =
+    EC::Meta::TypeList<C0, C1, TrackedC0, TrackedC1>;
+
+void TEST_EC_ChangeTracking() {
+    EC::Manager<ListComponentsTracked, ListTagsAll> manager;
+    manager.setThreadCount(4);
+    for (std::size_t i = 0; i < 10000; ++i) {
+        const std::size_t id = manager.addEntity();
+        manager.addComponent<TrackedC0>(id, static_cast<int>(id));
+        manager.addComponent<C0>(id);
+        if (id % 1000 == 0) {
+            manager.addTag<T0>(id);
+        }
+    }
+
+    using ChangedC0 = EC::Meta::TypeList<EC::Changed<TrackedC0>>;
+    using AddedC0 = EC::Meta::TypeList<EC::Added<TrackedC0>>;
+    using AddedC1 = EC::Meta::TypeList<EC::Added<TrackedC1>>;
+    using ChangedC1 = EC::Meta::TypeList<EC::Changed<TrackedC1>>;
+
+    // by default every Component passes the filters
+    CHECK_EQ(manager.getChangeFilterTick(), 0);
+    CHECK_EQ(manager.countMatching<ChangedC0>(), 10000);
+    CHECK_EQ(manager.countMatching<AddedC0>(), 10000);
+
+    manager.setChangeFilterTick(manager.getChangeTick());
+    CHECK_EQ(manager.countMatching<ChangedC0>(), 0);
+    CHECK_FALSE(manager.anyMatching<AddedC0>());
+
+    // replacing a Component changes it, adding one to an entity adds it
+    manager.addComponent<TrackedC0>(5, 50);
+    manager.addComponent<TrackedC1>(7);
+    manager.addComponent<TrackedC1>(9500);
+    // systems using EC::Mutable change the Component
+    manager.forMatchingSignature<EC::Meta::TypeList<EC::Mutable<TrackedC0>, T0>>(
+        [] (std::size_t, void*, TrackedC0* c0) { ++c0->y; });
+    manager.markChanged<TrackedC1>(9500);
+    manager.markChanged<TrackedC1>(8);
+
+    const std::vector<std::size_t> changedC0{0, 5, 1000, 2000, 3000, 4000,
+                                             5000, 6000, 7000, 8000, 9000};
+    for (int mode = 0; mode < 3; ++mode) {
+        manager.setArchetypeIndexEnabled(mode == 1);
+        manager.setParallelSplitByMatching(mode == 2);
+        for (int threaded = 0; threaded < 2; ++threaded) {
+            std::vector<std::size_t> ids;
+            std::mutex mutex;
+            manager.forMatchingSignature<ChangedC0>(
+                [&ids, &mutex] (std::size_t id, void*, TrackedC0* c0) {
+                    CHECK_EQ(c0->x, id == 5 ? 50 : static_cast<int>(id));
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ids.push_back(id);
+                },
+                nullptr, threaded != 0);
+            std::sort(ids.begin(), ids.end());
+            CHECK_TRUE(ids == changedC0);
+
+            CHECK_EQ(manager.countMatching<ChangedC0>(threaded != 0), 11);
+            CHECK_EQ(manager.countMatching<AddedC0>(threaded != 0), 0);
+            CHECK_EQ(manager.countMatching<AddedC1>(threaded != 0), 2);
+            CHECK_EQ(manager.countMatching<ChangedC1>(threaded != 0), 2);
+        }
+    }
+
+    // a signature with a filter is not reused by the planner for others
+    std::size_t allC0 = 0;
+    std::size_t filtered = 0;
+    manager.forMatchingSignatures<
+        EC::Meta::TypeList<ChangedC0, EC::Meta::TypeList<TrackedC0>,
+                           EC::Meta::TypeList<EC::Changed<TrackedC0>, T0>>>(
+        std::make_tuple(
+            [] (std::size_t, void*, TrackedC0*) {},
+            [&allC0] (std::size_t, void*, TrackedC0*) { ++allC0; },
+            [&filtered] (std::size_t, void*, TrackedC0*) { ++filtered; }));
+    CHECK_EQ(allC0, 10000);
+    CHECK_EQ(filtered, 10);
+
+    std::size_t viewed = 0;
+    for (auto entity : manager.view<ChangedC0>()) {
+        TrackedC0& c0 = std::get<1>(entity);
+        CHECK_EQ(c0.x, std::get<0>(entity) == 5
+                           ? 50
+                           : static_cast<int>(std::get<0>(entity)));
+        ++viewed;
+    }
+    CHECK_EQ(viewed, 11);
+
+    std::size_t stored = 0;
+    manager.addForMatchingFunction<ChangedC0>(
+        [&stored] (std::size_t, void*, TrackedC0*) { ++stored; });
+    manager.callForMatchingFunctions();
+    CHECK_EQ(stored, 11);
+
+    // nothing changed after the newest tick
+    manager.setChangeFilterTick(manager.getChangeTick());
+    CHECK_EQ(manager.countMatching<ChangedC0>(), 0);
+    stored = 0;
+    manager.callForMatchingFunctions();
+    CHECK_EQ(stored, 0);
+}
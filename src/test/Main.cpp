@@ -21,6 +21,26 @@ int main() {
     TEST_EC_ManagerWithLowThreadCount();
     TEST_EC_ManagerDeferredDeletions();
     TEST_EC_NestedThreadPoolTasks();
+    TEST_EC_RuntimeThreadCount();
+    TEST_EC_SharedThreadPool();
+    TEST_EC_ParallelPartitioning();
+    TEST_EC_AliveSnapshot();
+    TEST_EC_ContiguousStorage();
+    TEST_EC_SparseStoragePolicy();
+    TEST_EC_ArchetypeIndex();
+    TEST_EC_StoredFunctionCaches();
+    TEST_EC_BitHelpers();
+    TEST_EC_Bitplanes();
+    TEST_EC_SummaryBitmaps();
+    TEST_EC_SignatureFilters();
+    TEST_EC_ForMatchingChunks();
+    TEST_EC_View();
+    TEST_EC_OrderedParallelMatching();
+    TEST_EC_MatchPlan();
+    TEST_EC_FusedSignatures();
+    TEST_EC_QueryMatching();
+    TEST_EC_ForMatchingReduce();
+    TEST_EC_ChangeTracking();
 
     TEST_Meta_Contains();
     TEST_Meta_ContainsAll();
@@ -36,6 +56,13 @@ int main() {
     TEST_ECThreadPool_Simple();
     TEST_ECThreadPool_QueryCount();
     TEST_ECThreadPool_easyStartAndWait();
+    TEST_ECThreadPool_Batches();
+    TEST_ECThreadPool_CallerParticipates();
+    TEST_ECThreadPool_ConcurrentSubmitters();
+    TEST_ECThreadPool_CallableStorage();
+    TEST_ECThreadPool_SetThreadCount();
+    TEST_ECThreadPool_QueuedNotStarted();
+    TEST_ECThreadPool_ThrowingFunction();
 
     std::cout << "checks_checked: " << checks_checked.load() << '\n'
               << "checks_passed:  " << checks_passed.load() << std::endl;
@@ -1,5 +1,14 @@
 #include "test_helpers.h"
 
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
+
 #include <EC/ThreadPool.hpp>
 
 using OneThreadPool = EC::ThreadPool<1>;
@@ -16,7 +25,7 @@ void TEST_ECThreadPool_OneThread() {
 
     p.queueFn(fn, &data);
 
-    p.startThreads();
+    CHECK_TRUE(std::get<0>(p.startThreads()) == nullptr);
 
     do {
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -47,7 +56,7 @@ void TEST_ECThreadPool_Simple() {
 
     p.queueFn(fn, &data);
 
-    p.startThreads();
+    CHECK_TRUE(std::get<0>(p.startThreads()) == nullptr);
 
     do {
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -75,6 +84,8 @@ void TEST_ECThreadPool_QueryCount() {
     {
         ThreeThreadPool threeP;
         ASSERT_EQ(3, threeP.getMaxThreadCount());
+        static_assert(threeP.getMaxThreadCount() == 3,
+                      "getMaxThreadCount() is a constant expression");
     }
 }
 
@@ -104,3 +115,286 @@ void TEST_ECThreadPool_easyStartAndWait() {
         CHECK_EQ(40, data.load());
     }
 }
+
+void TEST_ECThreadPool_Batches() {
+    ThreeThreadPool p;
+    std::atomic_int dataA;
+    std::atomic_int dataB;
+    dataA.store(0);
+    dataB.store(0);
+    // counts the threads other than this one that ran a function, as a
+    // thread_local counter starts over in every new thread
+    std::atomic_int threadsSeen;
+    threadsSeen.store(0);
+    const std::thread::id callerId = std::this_thread::get_id();
+    using DataType =
+        std::tuple<std::atomic_int*, std::atomic_int*, const std::thread::id*>;
+    DataType dataATuple{&dataA, &threadsSeen, &callerId};
+    DataType dataBTuple{&dataB, &threadsSeen, &callerId};
+    const auto fn = [](void *ud) {
+        auto *data = static_cast<DataType*>(ud);
+        std::get<0>(*data)->fetch_add(1);
+        thread_local unsigned int runs = 0;
+        if(std::this_thread::get_id() != *std::get<2>(*data) && runs++ == 0) {
+            std::get<1>(*data)->fetch_add(1);
+        }
+    };
+
+    // Workers persist, so repeated dispatches reuse the same threads.
+    for(unsigned int i = 0; i < 100; ++i) {
+        EC::TPBatch batchA;
+        EC::TPBatch batchB;
+        for(unsigned int j = 0; j < 4; ++j) {
+            p.queueFn(fn, &dataATuple, batchA);
+            p.queueFn(fn, &dataBTuple, batchB);
+        }
+        p.easyStartAndWait(batchA);
+        CHECK_EQ(0, batchA.getPendingCount());
+        p.easyStartAndWait(batchB);
+        CHECK_EQ(0, batchB.getPendingCount());
+    }
+
+    CHECK_EQ(400, dataA.load());
+    CHECK_EQ(400, dataB.load());
+    CHECK_LE(threadsSeen.load(), 3);
+}
+
+void TEST_ECThreadPool_CallerParticipates() {
+    // Both workers are kept busy until a function of another batch runs,
+    // which only the thread calling easyStartAndWait() can do.
+    EC::ThreadPool<2> p;
+    std::atomic_int started;
+    started.store(0);
+    std::atomic_bool released;
+    released.store(false);
+    std::thread::id ranOn;
+    using DataType =
+        std::tuple<std::atomic_int*, std::atomic_bool*, std::thread::id*>;
+    DataType data{&started, &released, &ranOn};
+
+    EC::TPBatch workerBatch;
+    for(unsigned int i = 0; i < 2; ++i) {
+        p.queueFn([] (void *ud) {
+            auto *data = static_cast<DataType*>(ud);
+            std::get<0>(*data)->fetch_add(1);
+            while(!std::get<1>(*data)->load()) {
+                std::this_thread::yield();
+            }
+        }, &data, workerBatch);
+    }
+    p.startThreads();
+    while(started.load() < 2) {
+        std::this_thread::yield();
+    }
+
+    EC::TPBatch callerBatch;
+    p.queueFn([] (void *ud) {
+        auto *data = static_cast<DataType*>(ud);
+        *std::get<2>(*data) = std::this_thread::get_id();
+        std::get<1>(*data)->store(true);
+    }, &data, callerBatch);
+    p.easyStartAndWait(callerBatch);
+    CHECK_TRUE(ranOn == std::this_thread::get_id());
+
+    p.easyStartAndWait(workerBatch);
+    CHECK_EQ(0, workerBatch.getPendingCount());
+}
+
+void TEST_ECThreadPool_ConcurrentSubmitters() {
+    // Several threads queue fine-grained functions into the same pool, each
+    // waiting only on its own batch.
+    EC::ThreadPool<4> p;
+    std::atomic_int data;
+    data.store(0);
+    std::atomic_int mismatches;
+    mismatches.store(0);
+
+    std::vector<std::thread> submitters;
+    for(unsigned int t = 0; t < 4; ++t) {
+        submitters.emplace_back([&p, &data, &mismatches] () {
+            for(unsigned int round = 0; round < 10; ++round) {
+                std::atomic_int local;
+                local.store(0);
+                EC::TPBatch batch;
+                for(unsigned int i = 0; i < 250; ++i) {
+                    p.queueFn([] (void *ud) {
+                        static_cast<std::atomic_int*>(ud)->fetch_add(1);
+                    }, &local, batch);
+                }
+                p.easyStartAndWait(batch);
+                if(local.load() != 250) {
+                    mismatches.fetch_add(1);
+                }
+                data.fetch_add(local.load());
+            }
+        });
+    }
+    for(auto &submitter : submitters) {
+        submitter.join();
+    }
+
+    CHECK_EQ(0, mismatches.load());
+    CHECK_EQ(10000, data.load());
+}
+
+void TEST_ECThreadPool_CallableStorage() {
+    using FnPtr = void(*)(void*);
+    CHECK_TRUE(EC::Internal::TPTask::isStoredInline<FnPtr>());
+    CHECK_FALSE(
+        EC::Internal::TPTask::isStoredInline<std::function<void(void*)>>());
+
+    ThreeThreadPool p;
+    std::atomic_int data;
+    data.store(0);
+
+    // std::function and large captures are moved to the heap.
+    std::function<void(void*)> stdFn = [] (void *ud) {
+        static_cast<std::atomic_int*>(ud)->fetch_add(1);
+    };
+    std::array<int, 32> large{};
+    large.fill(2);
+    for(unsigned int i = 0; i < 8; ++i) {
+        p.queueFn(stdFn, &data);
+        p.queueFn([large] (void *ud) {
+            static_cast<std::atomic_int*>(ud)->fetch_add(large[31]);
+        }, &data);
+    }
+    p.easyStartAndWait();
+
+    CHECK_EQ(24, data.load());
+
+    // More functions than the initial ring buffer capacity.
+    for(unsigned int i = 0; i < 1000; ++i) {
+        p.queueFn([] (void *ud) {
+            static_cast<std::atomic_int*>(ud)->fetch_add(1);
+        }, &data);
+    }
+    p.easyStartAndWait();
+
+    CHECK_EQ(1024, data.load());
+}
+
+void TEST_ECThreadPool_SetThreadCount() {
+    EC::ThreadPool<EC::HardwareThreadCount> p;
+    const unsigned int hardwareCount = std::thread::hardware_concurrency();
+    CHECK_EQ(hardwareCount == 0 ? 1 : hardwareCount, p.getThreadCount());
+    CHECK_EQ(p.getThreadCount(), p.getMaxThreadCount());
+
+    std::atomic_int data;
+    data.store(0);
+    const auto fn = [](void *ud) {
+        static_cast<std::atomic_int*>(ud)->fetch_add(1);
+    };
+
+    unsigned int expected = 0;
+    for(unsigned int count : {2u, 1u, 5u, 0u, 3u}) {
+        p.setThreadCount(count);
+        CHECK_EQ(count, p.getThreadCount());
+        for(unsigned int i = 0; i < 20; ++i) {
+            p.queueFn(fn, &data);
+        }
+        p.easyStartAndWait();
+        expected += 20;
+        CHECK_EQ(expected, data.load());
+    }
+
+    EC::ThreadPool<1> explicitP(3);
+    CHECK_EQ(1, explicitP.getMaxThreadCount());
+    CHECK_EQ(3, explicitP.getThreadCount());
+}
+
+void TEST_ECThreadPool_QueuedNotStarted() {
+    ThreeThreadPool p;
+    std::atomic_int data;
+    data.store(0);
+    const auto fn = [](void *ud) {
+        static_cast<std::atomic_int*>(ud)->fetch_add(1);
+    };
+
+    // Workers that are still awake from a previous call must not pick up
+    // functions that have only been queued.
+    for(unsigned int i = 0; i < 10; ++i) {
+        p.queueFn(fn, &data);
+    }
+    p.easyStartAndWait();
+    CHECK_EQ(10, data.load());
+
+    // Keep a worker inside a started function while more functions are
+    // queued, so the pool is awake when they arrive.
+    std::atomic_bool entered;
+    entered.store(false);
+    std::atomic_bool released;
+    released.store(false);
+    using GateType = std::tuple<std::atomic_bool*, std::atomic_bool*>;
+    GateType gate{&entered, &released};
+
+    EC::TPBatch gateBatch;
+    p.queueFn([] (void *ud) {
+        auto *gate = static_cast<GateType*>(ud);
+        std::get<0>(*gate)->store(true);
+        while(!std::get<1>(*gate)->load()) {
+            std::this_thread::yield();
+        }
+    }, &gate, gateBatch);
+    p.startThreads();
+    while(!entered.load()) {
+        std::this_thread::yield();
+    }
+
+    for(unsigned int i = 0; i < 10; ++i) {
+        p.queueFn(fn, &data);
+    }
+    CHECK_FALSE(p.isQueueEmpty());
+
+    // The worker returns to its loop once released, but the functions queued
+    // above are still pending until the next startThreads().
+    released.store(true);
+    gateBatch.wait();
+    CHECK_EQ(10, data.load());
+    CHECK_FALSE(p.isQueueEmpty());
+
+    p.easyStartAndWait();
+    CHECK_EQ(20, data.load());
+    CHECK_TRUE(p.isQueueEmpty());
+}
+
+void TEST_ECThreadPool_ThrowingFunction() {
+    // functions run on the calling thread, so the exception reaches it
+    OneThreadPool p;
+    std::atomic_int data;
+    data.store(0);
+    const auto fn = [](void *ud) {
+        static_cast<std::atomic_int*>(ud)->fetch_add(1);
+    };
+    auto owner = std::make_shared<int>(0);
+
+    EC::TPBatch batch;
+    for(unsigned int i = 0; i < 10; ++i) {
+        p.queueFn(fn, &data, batch);
+        if(i == 4) {
+            // stored on the heap, so it must be released after throwing
+            p.queueFn(std::function<void(void*)>([owner] (void *) {
+                throw std::runtime_error("queued function failed");
+            }), nullptr, batch);
+        }
+    }
+    CHECK_EQ(2, owner.use_count());
+
+    bool caught = false;
+    try {
+        p.easyStartAndWait(batch);
+    } catch(const std::runtime_error &) {
+        caught = true;
+    }
+    CHECK_TRUE(caught);
+    CHECK_EQ(10, data.load());
+    CHECK_EQ(0, batch.getPendingCount());
+    CHECK_TRUE(p.isQueueEmpty());
+    CHECK_TRUE(p.isNotRunning());
+    CHECK_EQ(1, owner.use_count());
+
+    // the pool is still usable afterwards
+    p.queueFn(fn, &data);
+    p.easyStartAndWait();
+    CHECK_EQ(11, data.load());
+}
@@ -146,6 +146,26 @@ void TEST_EC_MultiThreadedForMatching();
 void TEST_EC_ManagerWithLowThreadCount();
 void TEST_EC_ManagerDeferredDeletions();
 void TEST_EC_NestedThreadPoolTasks();
+void TEST_EC_RuntimeThreadCount();
+void TEST_EC_SharedThreadPool();
+void TEST_EC_ParallelPartitioning();
+void TEST_EC_AliveSnapshot();
+void TEST_EC_ContiguousStorage();
+void TEST_EC_SparseStoragePolicy();
+void TEST_EC_ArchetypeIndex();
+void TEST_EC_StoredFunctionCaches();
+void TEST_EC_BitHelpers();
+void TEST_EC_Bitplanes();
+void TEST_EC_SummaryBitmaps();
+void TEST_EC_SignatureFilters();
+void TEST_EC_ForMatchingChunks();
+void TEST_EC_View();
+void TEST_EC_OrderedParallelMatching();
+void TEST_EC_MatchPlan();
+void TEST_EC_FusedSignatures();
+void TEST_EC_QueryMatching();
+void TEST_EC_ForMatchingReduce();
+void TEST_EC_ChangeTracking();
 
 void TEST_Meta_Contains();
 void TEST_Meta_ContainsAll();
@@ -161,4 +181,11 @@ void TEST_ECThreadPool_OneThread();
 void TEST_ECThreadPool_Simple();
 void TEST_ECThreadPool_QueryCount();
 void TEST_ECThreadPool_easyStartAndWait();
+void TEST_ECThreadPool_Batches();
+void TEST_ECThreadPool_CallerParticipates();
+void TEST_ECThreadPool_ConcurrentSubmitters();
+void TEST_ECThreadPool_CallableStorage();
+void TEST_ECThreadPool_SetThreadCount();
+void TEST_ECThreadPool_QueuedNotStarted();
+void TEST_ECThreadPool_ThrowingFunction();
 #endif